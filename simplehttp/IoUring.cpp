@@ -0,0 +1,195 @@
+/*! \file IoUring.cpp
+    \brief minimal io_uring ring, for SimpleHttp's io_uring backend (-DUSE_IO_URING)
+ */
+#include "IoUring.hpp"
+
+#ifdef USE_IO_URING
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define LOAD_ACQUIRE(p)     __atomic_load_n( (p), __ATOMIC_ACQUIRE )
+#define STORE_RELEASE(p,v)  __atomic_store_n( (p), (v), __ATOMIC_RELEASE )
+
+static int uring_setup( unsigned int entries, struct io_uring_params *p )
+{
+    return (int) syscall( __NR_io_uring_setup, entries, p );
+}
+
+static int uring_enter( int fd, unsigned int to_submit, unsigned int min_complete,
+        unsigned int flags, void *arg, size_t argsz )
+{
+    return (int) syscall( __NR_io_uring_enter, fd, to_submit, min_complete,
+            flags, arg, argsz );
+}
+
+static int uring_register( int fd, unsigned int opcode, void *arg, unsigned int nr_args )
+{
+    return (int) syscall( __NR_io_uring_register, fd, opcode, arg, nr_args );
+}
+
+
+IoUring::IoUring()
+{
+    fd = -1;
+    ring_ptr = MAP_FAILED;
+    sqes = (struct io_uring_sqe *) MAP_FAILED;
+    buf_ring = (struct io_uring_buf_ring *) MAP_FAILED;
+    bufs = NULL;
+    ring_size = sqes_size = buf_ring_size = 0;
+    sq_entries = sq_local_tail = 0;
+    buf_count = buf_size = 0;
+}
+
+IoUring::~IoUring()
+{
+    if ( buf_ring != MAP_FAILED )
+        munmap( buf_ring, buf_ring_size );
+    if ( sqes != MAP_FAILED )
+        munmap( sqes, sqes_size );
+    if ( ring_ptr != MAP_FAILED )
+        munmap( ring_ptr, ring_size );
+    if ( fd >= 0 )
+        close( fd );
+    free( bufs );
+}
+
+
+bool IoUring::init( unsigned int entries, unsigned int nbufs, unsigned int bufsize )
+{
+    struct io_uring_params p;
+    memset( &p, 0, sizeof(p) );
+    fd = uring_setup( entries, &p );
+    if ( fd < 0 )
+        return false;
+    if ( !( p.features & IORING_FEAT_SINGLE_MMAP )
+            || !( p.features & IORING_FEAT_EXT_ARG ) )
+        return false; // (pre 5.11 kernel)
+
+    // one mmap for both rings, one for the sqe array
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring_size = sq_size > cq_size ? sq_size : cq_size;
+    ring_ptr = mmap( NULL, ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING );
+    if ( ring_ptr == MAP_FAILED )
+        return false;
+    sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = (struct io_uring_sqe *) mmap( NULL, sqes_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES );
+    if ( sqes == MAP_FAILED )
+        return false;
+
+    char *ring = (char *) ring_ptr;
+    sq_head = (unsigned int *)( ring + p.sq_off.head );
+    sq_tail = (unsigned int *)( ring + p.sq_off.tail );
+    sq_mask = (unsigned int *)( ring + p.sq_off.ring_mask );
+    sq_array = (unsigned int *)( ring + p.sq_off.array );
+    sq_entries = p.sq_entries;
+    sq_local_tail = *sq_tail;
+    cq_head = (unsigned int *)( ring + p.cq_off.head );
+    cq_tail = (unsigned int *)( ring + p.cq_off.tail );
+    cq_mask = (unsigned int *)( ring + p.cq_off.ring_mask );
+    cqes = (struct io_uring_cqe *)( ring + p.cq_off.cqes );
+
+    // provided buffer ring (nbufs must be a power of 2)
+    buf_count = nbufs;
+    buf_size = bufsize;
+    buf_ring_size = buf_count * sizeof(struct io_uring_buf);
+    buf_ring = (struct io_uring_buf_ring *) mmap( NULL, buf_ring_size,
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if ( buf_ring == MAP_FAILED )
+        return false;
+    bufs = (char *) malloc( (size_t)buf_count * buf_size );
+    if ( bufs == NULL )
+        return false;
+    struct io_uring_buf_reg reg;
+    memset( &reg, 0, sizeof(reg) );
+    reg.ring_addr = (uint64_t)(uintptr_t) buf_ring;
+    reg.ring_entries = buf_count;
+    reg.bgid = buf_group;
+    if ( uring_register( fd, IORING_REGISTER_PBUF_RING, &reg, 1 ) < 0 )
+        return false; // (pre 5.19 kernel)
+    STORE_RELEASE( &buf_ring->tail, 0 );
+    for (unsigned int bid=0; bid<buf_count; bid++)
+        recycle( bid );
+    return true;
+}
+
+
+void IoUring::recycle( unsigned int bid )
+{
+    unsigned short tail = buf_ring->tail;
+    // (not &buf_ring->bufs[]: the uapi flex array is misplaced when compiled as C++)
+    struct io_uring_buf *b = (struct io_uring_buf *) buf_ring + ( tail & ( buf_count - 1 ) );
+    b->addr = (uint64_t)(uintptr_t) buffer( bid );
+    b->len = buf_size;
+    b->bid = (unsigned short) bid;
+    STORE_RELEASE( &buf_ring->tail, (unsigned short)( tail + 1 ) );
+}
+
+
+struct io_uring_sqe * IoUring::sqe()
+{
+    if ( sq_local_tail - LOAD_ACQUIRE( sq_head ) >= sq_entries )
+        submit();
+    unsigned int index = sq_local_tail & *sq_mask;
+    struct io_uring_sqe *s = &sqes[ index ];
+    memset( s, 0, sizeof(*s) );
+    sq_array[ index ] = index;
+    sq_local_tail++;
+    return s;
+}
+
+int IoUring::submit()
+{
+    STORE_RELEASE( sq_tail, sq_local_tail );
+    unsigned int pending = sq_local_tail - LOAD_ACQUIRE( sq_head );
+    if ( pending == 0 )
+        return 0;
+    return uring_enter( fd, pending, 0, 0, NULL, 0 );
+}
+
+int IoUring::wait( int timeout_ms )
+{
+    STORE_RELEASE( sq_tail, sq_local_tail );
+    unsigned int pending = sq_local_tail - LOAD_ACQUIRE( sq_head );
+    if ( timeout_ms < 0 )
+        return uring_enter( fd, pending, 1, IORING_ENTER_GETEVENTS, NULL, 0 );
+    if ( timeout_ms == 0 ) // (completions, if any, are already in the ring)
+        return pending ? uring_enter( fd, pending, 0, 0, NULL, 0 ) : 0;
+
+    struct __kernel_timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (long long)( timeout_ms % 1000 ) * 1000000;
+    struct io_uring_getevents_arg arg;
+    memset( &arg, 0, sizeof(arg) );
+    arg.sigmask_sz = _NSIG / 8;
+    arg.ts = (uint64_t)(uintptr_t) &ts;
+    int rv = uring_enter( fd, pending, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+            &arg, sizeof(arg) );
+    if ( rv < 0 && ( errno == ETIME || errno == EINTR ) )
+        return 0;
+    return rv;
+}
+
+
+struct io_uring_cqe * IoUring::peek()
+{
+    unsigned int head = *cq_head;
+    if ( head == LOAD_ACQUIRE( cq_tail ) )
+        return NULL;
+    return &cqes[ head & *cq_mask ];
+}
+
+void IoUring::seen()
+{
+    STORE_RELEASE( cq_head, *cq_head + 1 );
+}
+
+#endif // USE_IO_URING
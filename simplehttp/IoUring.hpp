@@ -0,0 +1,120 @@
+/*! \file IoUring.hpp
+    \brief minimal io_uring ring, for SimpleHttp's io_uring backend (-DUSE_IO_URING)
+
+  * talks to the kernel through the uapi header, so it builds without liburing
+  * one submission/completion ring plus one provided buffer ring (recv
+    buffers the kernel picks from, so an idle connection holds no buffer)
+  * linux >= 6.0 (multishot recv, buffer rings); init() fails otherwise
+ */
+#ifndef _IOURING_HPP
+#define _IOURING_HPP 1
+
+#ifdef USE_IO_URING
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+//!> io_uring submission/completion ring with a provided buffer ring
+class IoUring {
+    private:
+        // submission queue
+        unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+        struct io_uring_sqe *sqes;
+        unsigned int sq_entries;
+        unsigned int sq_local_tail;     //!< sqes handed out, not yet published
+        // completion queue
+        unsigned int *cq_head, *cq_tail, *cq_mask;
+        struct io_uring_cqe *cqes;
+        // mmaps
+        void *ring_ptr;
+        size_t ring_size;
+        size_t sqes_size;
+        // provided buffers
+        struct io_uring_buf_ring *buf_ring;
+        char *bufs;
+        unsigned int buf_count;
+        unsigned int buf_size;
+        size_t buf_ring_size;
+
+        IoUring( const IoUring & );
+        IoUring & operator=( const IoUring & );
+    public:
+        IoUring();
+        ~IoUring();
+
+        bool init( unsigned int entries, unsigned int nbufs, unsigned int bufsize );
+                    //!< set up ring and buffer group 0; false if unsupported
+
+        struct io_uring_sqe *sqe();     //!< next (zeroed) sqe; submits if the queue is full
+        int submit();                   //!< submit queued sqes
+        int wait( int timeout_ms );     //!< submit, wait for a completion (-1 = forever)
+        struct io_uring_cqe *peek();    //!< next completion, or NULL
+        void seen();                    //!< done with the completion from peek()
+
+        const char *buffer( unsigned int bid ) { return bufs + (size_t)bid * buf_size; }
+        void recycle( unsigned int bid );   //!< give a provided buffer back to the kernel
+
+        int fd;             //!< ring fd, -1 if not set up
+        static const unsigned short buf_group = 0;
+};
+
+//!> sqe preparation (what liburing calls io_uring_prep_*)
+static inline void uring_prep( struct io_uring_sqe *s, int op, int fd,
+        const void *addr, unsigned int len, uint64_t user_data )
+{
+    s->opcode = (uint8_t) op;
+    s->fd = fd;
+    s->addr = (uint64_t)(uintptr_t) addr;
+    s->len = len;
+    s->user_data = user_data;
+}
+
+static inline void uring_prep_multishot_accept( struct io_uring_sqe *s, int fd, uint64_t user_data )
+{
+    uring_prep( s, IORING_OP_ACCEPT, fd, NULL, 0, user_data );
+    s->ioprio |= IORING_ACCEPT_MULTISHOT;
+}
+
+static inline void uring_prep_multishot_recv( struct io_uring_sqe *s, int fd,
+        unsigned short buf_group, uint64_t user_data )
+{
+    uring_prep( s, IORING_OP_RECV, fd, NULL, 0, user_data );
+    s->ioprio |= IORING_RECV_MULTISHOT;
+    s->flags |= IOSQE_BUFFER_SELECT;
+    s->buf_group = buf_group;
+}
+
+static inline void uring_prep_poll( struct io_uring_sqe *s, int fd,
+        unsigned int poll_mask, uint64_t user_data )
+{
+    uring_prep( s, IORING_OP_POLL_ADD, fd, NULL, 0, user_data );
+    s->poll32_events = poll_mask;
+}
+
+static inline void uring_prep_send( struct io_uring_sqe *s, int fd,
+        const void *buf, unsigned int len, uint64_t user_data )
+{
+    uring_prep( s, IORING_OP_SEND, fd, buf, len, user_data );
+    s->msg_flags = MSG_NOSIGNAL;
+}
+
+static inline void uring_prep_shutdown( struct io_uring_sqe *s, int fd, uint64_t user_data )
+{
+    uring_prep( s, IORING_OP_SHUTDOWN, fd, NULL, SHUT_RDWR, user_data );
+}
+
+static inline void uring_prep_close( struct io_uring_sqe *s, int fd, uint64_t user_data )
+{
+    uring_prep( s, IORING_OP_CLOSE, fd, NULL, 0, user_data );
+}
+
+static inline void uring_prep_cancel( struct io_uring_sqe *s, uint64_t target, uint64_t user_data )
+{
+    uring_prep( s, IORING_OP_ASYNC_CANCEL, -1, NULL, 0, user_data );
+    s->addr = target;
+}
+
+#endif // USE_IO_URING
+#endif // _IOURING_HPP
@@ -12,6 +12,8 @@
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <vector>
+#include <list>
 #ifdef USE_STD_THREAD
 #include <thread>
 #include <mutex>
@@ -23,21 +25,54 @@
 #include <sys/stat.h>
 
 #include "SimpleHttp.hpp"
+#include "TimerWheel.hpp"
+#include "IoUring.hpp"
+#include "WebSocket.hpp"
 
 #ifndef MS_WINDOWS
 // linux, etc
 # include <unistd.h>
 # include <sys/socket.h>
+# include <sys/time.h>
+# include <sys/wait.h>
+# ifdef __linux__
+#  include <sys/prctl.h>
+#  include <sys/sendfile.h>
+# endif
 # include <netinet/tcp.h>
 # include <netdb.h>
+# include <poll.h>
+# include <strings.h>
+# include <sys/uio.h>
+# include <sys/un.h>
+# include <limits.h>
+# include <deque>
+# include <set>
+# include <mutex>
+# define SOCKET_POLL   poll
 #else
 // Windows
 # include <io.h>
 # include <windows.h>
 # include <winsock2.h>
 # include <ws2tcpip.h>
+# define SOCKET_POLL   WSAPoll
+# define strncasecmp   _strnicmp
 #endif
 
+#ifdef HAVE_SYS_SDT_H
+# include <sys/sdt.h>   // USDT probes, for bpftrace, systemtap, etc
+# define PROBE2(name,a,b)   DTRACE_PROBE2( simplehttp, name, a, b )
+#else
+# define PROBE2(name,a,b)   ((void)(a), (void)(b))
+#endif
+
+#ifdef USE_OPENSSL
+# include <openssl/ssl.h>
+# include <openssl/err.h>
+#endif
+
+#include <algorithm>
 #include <fcntl.h>
 #include <signal.h>
 #include <errno.h>
@@ -48,6 +83,135 @@
 #  define SOMAXCONN 1000000
 #endif
 
+#define MAX_ACCEPTS_PER_POLL    64      // don't starve connections already open
+#define URING_ENTRIES           256     // io_uring backend: sq entries
+#define URING_BUFS              256     //   recv buffers (power of 2) ...
+#define URING_BUF_SIZE          ( READ_BUF_SIZE * 16 ) // ... of this size
+#define EVENT_LOOP_WAIT_MS      250     // longest eventLoop() waits before checking for stop()
+#define WORKER_RESTART_SECS     1       // min secs between starts of a worker
+#define WS_IOVECS               64      // frames per websocket writev
+#define FILL_WAIT_MS            ( 30 * 1000 ) // longest a miss waits for a fill (if no send_timeout_ms)
+
+//!> timer kinds, see http_conn
+enum timeout_type { IDLE_TIMEOUT, HEADER_TIMEOUT, BODY_TIMEOUT, FILL_TIMEOUT, SEND_TIMEOUT };
+
+//!> read state of an accepted connection (then, responding inline, writing)
+enum conn_state { CONN_IDLE, CONN_HEADER, CONN_BODY, CONN_WRITE };
+
+//!> connection being read by the event loop (until the request is complete),
+//!> or written (a response made inline, or from the cache)
+struct http_conn {
+    SOCKET_TYPE fd;
+    unsigned int gen;       //!< tells apart connections that reuse an fd
+    conn_state state;
+    std::string req;        //!< request read so far
+    size_t req_size;        //!< header + body size, once the header is in (else 0)
+    std::string ip_addr_str;
+    std::string host;       //!< from getnameinfo, with lookup_hosts (else "")
+    time_t accept_time;
+    timer_node timer;       //!< deadline of the current state
+    cache_fill *waiting_on; //!< response cache: parked, waiting for this fill
+    http_trace *trace;      //!< if sampled (trace_sink)
+    ssl_st *ssl;            //!< https: its tls (the handshake's done by the event loop)
+    bool tls_want_write;    //!<   the handshake's waiting to write
+    bool tls_want_read;     //!<   writing: openssl's waiting to read
+    std::string out;        //!< CONN_WRITE: response not sent yet ...
+    size_t out_sent;        //!< ... of which this much has been
+    int file;               //!<   then this file (-1 if none), sendfile()d ...
+    off_t file_off;         //!<   ... from here
+    off_t file_size;
+    bool write_armed;       //!< io_uring: waiting for POLLOUT
+};
+
+#ifndef MS_WINDOWS
+//!> a cached, fully serialized response
+struct cache_entry {
+    std::string response;
+    uint64_t expires_ms;
+    std::list< std::string >::iterator lru;     //!< (position in response_cache::lru)
+};
+
+//!> a response being made, once, for the cache and any clients waiting for it
+struct cache_fill {
+    std::string key;
+    unsigned int ttl_ms;
+    int read_fd;            //!< pipe from the responder (-1 if responding inline)
+    int write_fd;           //!< (its other end, until handed to the responder)
+    std::string data;       //!< read so far: length (uint64_t), then response
+    std::vector< http_conn * > waiters;
+};
+
+//!> response cache, for callback routes that opt in with SimpleHttp::cache()
+struct response_cache {
+    std::map< std::string, cache_entry > entries;   //!< key => response
+    std::list< std::string > lru;                   //!< keys, most recently used first
+    size_t bytes;                                   //!< keys + responses
+    std::map< std::string, cache_fill * > fills;    //!< key => fill in progress
+    std::map< int, cache_fill * > fill_fds;         //!< read_fd => fill
+    response_cache() : bytes(0) {}
+};
+
+typedef std::shared_ptr< const std::string > ws_frame_ptr; //!< (shared by a broadcast's sends)
+
+//!> an open websocket, handled by the event loop
+struct ws_conn {
+    SOCKET_TYPE fd;
+    unsigned int gen;       //!< (its http_conn's)
+    websocket_id id;
+    std::string route;
+    std::string in;         //!< read, not yet a whole frame
+    std::string msg;        //!< fragmented message so far ...
+    int msg_opcode;         //!< ... its opcode, 0 if none
+    std::deque< ws_frame_ptr > out; //!< frames to send
+    size_t out_sent;        //!< (of out.front())
+    size_t queued;          //!< bytes in out
+    bool closing;           //!< close frame queued: close once sent
+    bool closed;            //!< wsClose()d; freed by wsReap(), once no one's using it
+    bool write_armed;       //!< io_uring: waiting for POLLOUT
+};
+
+//!> a frame for the event loop to send (ws_send, ws_broadcast, ws_close)
+struct ws_post {
+    websocket_id id;        //!< to this websocket, or (0) ...
+    std::string route;      //!< ... all of route's
+    ws_frame_ptr frame;
+    bool close;             //!< then close
+};
+
+//!> websockets of this process
+struct ws_state {
+    std::map< SOCKET_TYPE, ws_conn * > conns;
+    std::map< websocket_id, ws_conn * > ids;
+    std::vector< ws_conn * > closed;    //!< to free (wsReap)
+    websocket_id last_id;
+    std::mutex lock;                //!< guards posted, woken
+    std::vector< ws_post > posted;  //!< from any thread, for the event loop
+    bool woken;                     //!< a wake byte is in the pipe
+    int wake[2];                    //!< self-pipe: there's something posted
+    bool wake_armed;                //!< io_uring: poll on wake[0] pending
+    ws_state() : last_id(0), woken(false), wake_armed(false) { wake[0] = wake[1] = -1; }
+};
+
+//!> forking mode: sampled traces, from the children to the event loop's process
+struct trace_pipe {
+    int fd[2];
+    int pid;                //!< the event loop's process
+    std::string in;         //!< read, not yet a whole record
+    bool armed;             //!< io_uring: poll on fd[0] pending
+    trace_pipe() : pid(0), armed(false) { fd[0] = fd[1] = -1; }
+};
+
+//!> a trace, as a child writes it to the pipe (with its route after it,
+//!> in one write of at most PIPE_BUF: not interleaved with other children's)
+struct trace_record {
+    uint64_t id;
+    uint64_t t[ TRACE_PHASES ];
+    int32_t fd;
+    uint16_t route_len;
+    uint8_t cached;
+};
+#endif
+
 //!> construt simple http server object 
 SimpleHttp::SimpleHttp()
 {
@@ -72,17 +236,48 @@ void SimpleHttp::init()
     maxRecvBufferSize = 1024 * 128 ; // max recv message size [128k]
     max_getaddr_tries = 7;
     getaddr_retry_wait_secs = 15;
+    idle_timeout_ms = 10 * 1000;
+    header_timeout_ms = 10 * 1000;
+    body_timeout_ms = 30 * 1000;
+    send_timeout_ms = 30 * 1000;
+    io_backend = POLL_BACKEND;
+    workers = 0;
+    reuseport = false;
+    inline_dispatch = false;
+    lookup_hosts = false; // (getnameinfo() would block the event loop)
+    worker_id = -1;
+    cache_max_bytes = 16 * 1024 * 1024;
+    rcache = NULL;
+    trace_sink = NULL;
+    trace_sample = 1;
+    trace_seq = 0;
+    ws = NULL;
+    tpipe = NULL;
+    ws_max_backlog = 4 * 1024 * 1024;
+    ws_max_message = 1024 * 1024;
+    tls_ctx = NULL;
+    timers = new TimerWheel();
+    uring = NULL;
 }
 
 SimpleHttp::~SimpleHttp()
 {
     closeServer();
+    delete timers;
+#ifndef MS_WINDOWS
+    delete rcache;
+    delete ws;
+    delete tpipe;
+#endif
+#ifdef USE_OPENSSL
+    SSL_CTX_free( tls_ctx );
+#endif
 }
 
 
-void SimpleHttp:: set_nonblock(SOCKET_TYPE socket) {
+void SimpleHttp:: set_nonblock(SOCKET_TYPE socket, bool nonblock) {
 #ifdef MS_WINDOWS
-    u_long iMode=1;
+    u_long iMode = nonblock ? 1 : 0;
     ioctlsocket(socket,FIONBIO,&iMode); 
 #else
     int flags;
@@ -90,7 +285,7 @@ void SimpleHttp:: set_nonblock(SOCKET_TYPE socket) {
     if (! (flags != -1) ) 
         printf("set_nonblock: fcntl F_GETFL fails\n");
     else
-        fcntl(socket, F_SETFL, flags | O_NONBLOCK);
+        fcntl(socket, F_SETFL, nonblock ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK));
 #endif
 }
 
@@ -126,14 +321,10 @@ bool SimpleHttp::start()
     }
     if (log) printf("SimpleHttp::start ... \n");
 
-    struct addrinfo *_p;
-    struct addrinfo hints, *result;
-    int iResult;
-
 #ifdef MS_WINDOWS
     // Initialize Winsock
     WSADATA wsaData;
-    iResult = WSAStartup(MAKEWORD(2,2), &wsaData);
+    int iResult = WSAStartup(MAKEWORD(2,2), &wsaData);
     if (iResult != 0) {
         printf("WSAStartup failed with error: %d\n", iResult);
         status = SERVER_ERROR;
@@ -144,75 +335,23 @@ bool SimpleHttp::start()
 
 /////////////////////////////////////////
 
+    if ( listeners.empty() ) {
+        addListener( "", port, tls_ctx != NULL );
+        listeners.back().implicit = true; // (so a restart takes port anew)
+    }
+    for (size_t i=0; i<listeners.size(); i++) {
+        if ( listeners[i].https && tls_ctx == NULL ) {
+            printf("https listener on port %d, but no tls(), not started\n", listeners[i].port);
+            status = SERVER_ERROR;
+            return false;
+        }
+    }
     int get_addr_try = -1;
     for ( get_addr_try = 0;
           get_addr_try < max_getaddr_tries;
           get_addr_try++ ) 
     {
-        // getaddrinfo for host
-        memset (&hints, 0, sizeof(hints));
-        hints.ai_family = AF_INET;
-        hints.ai_socktype = SOCK_STREAM;
-        hints.ai_flags = AI_PASSIVE;
-#ifdef MS_WINDOWS
-        hints.ai_protocol = IPPROTO_TCP;
-#endif
-        std::stringstream port_str;
-        port_str << port;
-        if (log>1)
-            printf("SimpleHttp::start - getaddrinfor for port %s\n",
-                    port_str.str().c_str() );
-        if ( getaddrinfo( NULL, port_str.str().c_str(), &hints, &result) != 0)
-        {
-#ifdef MS_WINDOWS
-            printf("getaddrinfo() error\n");
-#else
-            perror ("getaddrinfo() error");
-#endif
-            status = SERVER_ERROR;
-            return false;
-        }
-
-        // socket and bind
-        for (_p = result; _p!=NULL; _p=_p->ai_next) // ? for win
-        {
-
-            if (log>1) printf("SimpleHttp::start - socket ...\n");
-#ifdef MS_WINDOWS
-            listen_socket = socket (_p->ai_family, _p->ai_socktype,
-                    _p->ai_protocol); // ?
-            if (listen_socket == INVALID_SOCKET) {
-                printf("socket failed with error: %ld\n", (long)WSAGetLastError());
-                freeaddrinfo( _p ); // or result ?
-                WSACleanup();
-                continue;
-            }
-#else
-            listen_socket = socket(_p->ai_family, _p->ai_socktype, 0);
-            if (listen_socket == SOCKET_ERROR) {
-                if (log>1) printf("SimpleHttp::start - socket() == SOCKET_ERROR, try next\n");
-                continue;
-            }
-#endif
-            if (log>1) printf("SimpleHttp::start - set non-block ...\n");
-            set_nonblock(listen_socket);
-
-            if (log>1) printf("SimpleHttp::start - bind ...\n");
-            iResult =  bind(listen_socket, _p->ai_addr, _p->ai_addrlen);
-            if ( iResult == 0 ) {
-                if (log>1) printf("SimpleHttp::start - bind(...) == 0, OK, stop\n");
-                break;
-            } else {
-                if (log>1) {
-                    printf("SimpleHttp::start - bind(...) == %d != 0, (bind fails)\n",iResult);
-#ifdef MS_WINDOWS
-                    if (iResult == SOCKET_ERROR)
-                        printf("bind failed with error %d\n", WSAGetLastError());
-#endif
-                }
-            }
-        }
-        if ( _p == NULL )
+        if ( ! openListeners() )
         {
 #define EMSG    "socket() or bind() problem, not started"
 #ifndef MS_WINDOWS
@@ -222,7 +361,7 @@ bool SimpleHttp::start()
 #endif
             status = SERVER_ERROR;
 
-            if ( get_addr_try >= max_getaddr_tries )
+            if ( get_addr_try+1 >= max_getaddr_tries )
                 return false;
 
             printf("# retry (%d of %d), after %d secs ...\n",
@@ -247,48 +386,489 @@ bool SimpleHttp::start()
 
     /////////////////////////////////////////
 
+#ifndef MS_WINDOWS
+    // (per request children aren't waited for; worker processes are, by
+    // pid, and SIGCHLD is left as the application has it)
+    if ( workers == 0 )
+        signal(SIGCHLD, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN); // ?
+#endif
+    status = STARTED;
+#ifndef MS_WINDOWS
+    if ( workers > 0 ) {
+        // pre-forked: the workers accept and respond, this process supervises
+        worker_pids.assign( workers, 0 );
+        worker_started.assign( workers, 0 );
+        for (int i=0; i<workers; i++)
+            startWorker( i );
+        if ( reuseport ) // workers have their own sockets; don't take a share
+            closeListeners( true ); // (a unix socket can't be, they share it)
+        if (log>1) printf("SimpleHttp::start - %d workers started OK\n", workers);
+        return true;
+    }
+#else
+    if ( workers > 0 )
+        printf("warning: no worker processes on windows, serving from this one\n");
+#endif
+    startBackend();
+    if (log>1) printf("SimpleHttp::start - server started OK\n");
+    return true;
+}
 
-    freeaddrinfo(result);
 
-    int option = 1;
+/* \brief set up the event loop backend (after start() or in a worker) */
+void SimpleHttp::startBackend()
+{
+    if ( io_backend == IO_URING_BACKEND ) {
+#ifdef USE_IO_URING
+        uring = new IoUring;
+        if ( ! uring->init( URING_ENTRIES, URING_BUFS, URING_BUF_SIZE ) ) {
+            perror("warning: io_uring unavailable, using poll");
+            delete uring;
+            uring = NULL;
+        }
+        else if (log>1) printf("SimpleHttp::start - io_uring backend\n");
+#else
+        printf("warning: not built with USE_IO_URING, using poll\n");
+#endif
+    }
 #ifndef MS_WINDOWS
-    signal(SIGCHLD, SIG_IGN);
-    signal(SIGPIPE, SIG_IGN); // ?
-    if ( setsockopt(listen_socket, SOL_SOCKET,
-                (SO_REUSEPORT | SO_REUSEADDR),
-                (char*)&option,sizeof(option)) < 0)
-        printf("warning: setsockopt failed ((SO_REUSEPORT|SO_REUSEADDR)\n");
+    if ( ws )
+        wsStart();
+#endif
+}
+
+
+/* \brief listen on host:port (before start()); host is a name or an ipv4
+   or ipv6 address ("[::1]" or "::1"), "" = any address: ipv6 and ipv4 on
+   one dual-stack socket, or ipv4 where there's no ipv6 */
+bool SimpleHttp::addListener( std::string host, int port, bool https )
+{
+    if ( status != INIT && status != CLOSED ) {
+        if (log) printf("SimpleHttp::addListener - server started, not added\n");
+        return false;
+    }
+    if ( host.size() >= 2 && host[0] == '[' && host[ host.size()-1 ] == ']' )
+        host = host.substr( 1, host.size()-2 );
+    listen_info l;
+    l.host = host;
+    l.port = port;
+    l.mode = 0;
+    l.https = https;
+    l.fd = INVALID_SOCKET;
+    l.accepting = false;
+    l.owner = 0;
+    l.implicit = false;
+    listeners.push_back( l );
+    if (log>1) printf("server listener: %s[%s]:%d\n", https ? "https " : "", host.c_str(), port );
+    return true;
+}
+
+/* \brief listen on a unix domain socket at path (before start()), with
+   permissions mode; a socket file left there by a server that's gone is
+   replaced, one that's still accepting (or any other file) is an error */
+bool SimpleHttp::addUnixListener( std::string path, int mode )
+{
+#ifdef MS_WINDOWS
+    printf("warning: no unix domain sockets on windows, %s not added\n", path.c_str());
+    return false;
+#else
+    if ( status != INIT && status != CLOSED ) {
+        if (log) printf("SimpleHttp::addUnixListener - server started, not added\n");
+        return false;
+    }
+    if ( path.empty() || path.size() >= sizeof( ((struct sockaddr_un *)0)->sun_path ) ) {
+        printf("warning: bad unix socket path \"%s\", not added\n", path.c_str());
+        return false;
+    }
+    listen_info l;
+    l.port = 0;
+    l.path = path;
+    l.mode = mode;
+    l.https = false;
+    l.fd = INVALID_SOCKET;
+    l.accepting = false;
+    l.owner = 0;
+    l.implicit = false;
+    listeners.push_back( l );
+    if (log>1) printf("server listener: %s (%04o)\n", path.c_str(), mode );
+    return true;
+#endif
+}
+
+
+/* \brief https: the certificate (chain) and private key, PEM files, for
+   the https listeners (and the one start() adds, without any others).
+   After the handshake, the kernel does the encryption (ktls) where it
+   can, so responses (file()s by sendfile) are written as if plain text;
+   otherwise openssl does.  Sessions resume by ticket, its key shared by
+   workers (and forks). */
+bool SimpleHttp::tls( std::string cert_file, std::string key_file )
+{
+#ifndef USE_OPENSSL
+    (void) cert_file;
+    (void) key_file;
+    printf("warning: not built with USE_OPENSSL, no https\n");
+    return false;
+#else
+    if ( status != INIT && status != CLOSED ) {
+        if (log) printf("SimpleHttp::tls - server started, not set\n");
+        return false;
+    }
+    SSL_CTX *ctx = SSL_CTX_new( TLS_server_method() );
+    if ( ctx == NULL ) {
+        ERR_print_errors_fp( stdout );
+        return false;
+    }
+    SSL_CTX_set_min_proto_version( ctx, TLS1_2_VERSION );
+    SSL_CTX_set_options( ctx, SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE );
+    // (non-blocking writes from the event loop: take what fits, retry from
+    // where the rest's been queued)
+    SSL_CTX_set_mode( ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER );
+# ifdef SSL_OP_ENABLE_KTLS
+    SSL_CTX_set_options( ctx, SSL_OP_ENABLE_KTLS ); // (if the kernel has the tls module)
+# endif
+    // resumption: stateless tickets, keyed per context (so, made before
+    // the workers fork, shared by them); one per connection is plenty
+    // with a connection per request
+    SSL_CTX_clear_options( ctx, SSL_OP_NO_TICKET );
+    SSL_CTX_set_num_tickets( ctx, 1 );
+    if ( SSL_CTX_use_certificate_chain_file( ctx, cert_file.c_str() ) != 1
+            || SSL_CTX_use_PrivateKey_file( ctx, key_file.c_str(), SSL_FILETYPE_PEM ) != 1
+            || SSL_CTX_check_private_key( ctx ) != 1 ) {
+        printf("tls: can't use %s, %s\n", cert_file.c_str(), key_file.c_str() );
+        ERR_print_errors_fp( stdout );
+        SSL_CTX_free( ctx );
+        return false;
+    }
+    SSL_CTX_free( tls_ctx );
+    tls_ctx = ctx;
+    if (log>1) printf("server tls: %s %s\n", cert_file.c_str(), key_file.c_str() );
+    return true;
 #endif
-    if ( tcp_nodelay ) {
-        if ( setsockopt(listen_socket,
-                    IPPROTO_TCP,     /* set option at TCP level */
-                    TCP_NODELAY,     /* name of option */
-                    (char*)&option,sizeof(option)) < 0 )
-            printf("warning: setsockopt failed (TCP_NODELAY)\n");
+}
+
+
+/* \brief open the listeners not open yet (tcp_only: just the tcp ones);
+   false, with none of them open, if one fails */
+bool SimpleHttp::openListeners( bool tcp_only )
+{
+    for (size_t i=0; i<listeners.size(); i++) {
+        listen_info &l = listeners[i];
+        if ( l.fd != INVALID_SOCKET || ( tcp_only && ! l.path.empty() ) )
+            continue;
+        l.fd = l.path.empty() ? openListenSocket( l ) : openUnixSocket( l );
+        l.accepting = false;
+        if ( l.fd == INVALID_SOCKET ) {
+            int e = errno;
+            closeListeners( tcp_only );
+            errno = e; // (for the caller's perror)
+            return false;
+        }
     }
+    listen_socket = listeners.empty() ? INVALID_SOCKET : listeners[0].fd;
+    return true;
+}
 
-    // listen for incoming connections
+/* \brief close the listeners (tcp_only: just the tcp ones); the process
+   that bound a unix socket removes its file */
+void SimpleHttp::closeListeners( bool tcp_only )
+{
+    for (size_t i=0; i<listeners.size(); i++) {
+        listen_info &l = listeners[i];
+        if ( l.fd == INVALID_SOCKET || ( tcp_only && ! l.path.empty() ) )
+            continue;
 #ifdef MS_WINDOWS
-    if ( listen (listen_socket, SOMAXCONN) == SOCKET_ERROR )
+        closesocket( l.fd );
 #else
-    if ( listen (listen_socket, SOMAXCONN) != 0 )
+        CLOSE( l.fd );
+        if ( ! l.path.empty() && l.owner == (int) getpid() ) {
+            unlink( l.path.c_str() );
+            l.owner = 0;
+        }
+#endif
+        l.fd = INVALID_SOCKET;
+        l.accepting = false;
+    }
+    listen_socket = listeners.empty() ? INVALID_SOCKET : listeners[0].fd;
+}
+
+
+/* \brief socket listening on l's host and port (on the first of its
+   addresses that works), or INVALID_SOCKET */
+SOCKET_TYPE SimpleHttp::openListenSocket( listen_info &l )
+{
+    struct addrinfo *_p;
+    struct addrinfo hints, *result;
+    SOCKET_TYPE s = INVALID_SOCKET;
+    int iResult;
+
+    // getaddrinfo for host
+    memset (&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+#ifdef MS_WINDOWS
+    hints.ai_protocol = IPPROTO_TCP;
 #endif
+    std::stringstream port_str;
+    port_str << l.port;
+    if (log>1)
+        printf("SimpleHttp::start - getaddrinfor for [%s]:%s\n",
+                l.host.c_str(), port_str.str().c_str() );
+    if ( getaddrinfo( l.host.empty() ? NULL : l.host.c_str(),
+                port_str.str().c_str(), &hints, &result) != 0)
     {
 #ifdef MS_WINDOWS
-        printf("listen failed with error: %d\n", WSAGetLastError());
-        closesocket(listen_socket);
-        WSACleanup();
+        printf("getaddrinfo() error\n");
 #else
-        perror("listen() error");
+        perror ("getaddrinfo() error");
 #endif
-        status = SERVER_ERROR;
-        return false;
+        return INVALID_SOCKET;
     }
-    status = STARTED;
-    if (log>1) printf("SimpleHttp::start - server started OK\n");
-    return true;
+
+    // socket, bind and listen; any address: try the ipv6 (dual-stack) ones first
+    bool any = l.host.empty();
+    int option = 1;
+    int v6only = 0;
+    for (int pass=0; pass<2 && s==INVALID_SOCKET; pass++)
+    for (_p = result; _p!=NULL; _p=_p->ai_next) // ? for win
+    {
+        if ( any ? ( pass == 0 ) != ( _p->ai_family == AF_INET6 ) : pass > 0 )
+            continue;
+
+        if (log>1) printf("SimpleHttp::start - socket ...\n");
+#ifdef MS_WINDOWS
+        s = socket (_p->ai_family, _p->ai_socktype,
+                _p->ai_protocol); // ?
+        if (s == INVALID_SOCKET) {
+            printf("socket failed with error: %ld\n", (long)WSAGetLastError());
+            continue;
+        }
+#else
+        s = socket(_p->ai_family, _p->ai_socktype, 0);
+        if (s == SOCKET_ERROR) {
+            if (log>1) printf("SimpleHttp::start - socket() == SOCKET_ERROR, try next\n");
+            s = INVALID_SOCKET;
+            continue;
+        }
+#endif
+        if (log>1) printf("SimpleHttp::start - set non-block ...\n");
+        set_nonblock(s);
+
+#ifndef MS_WINDOWS
+        if ( setsockopt(s, SOL_SOCKET, SO_REUSEADDR,
+                    (char*)&option,sizeof(option)) < 0)
+            printf("warning: setsockopt failed (SO_REUSEADDR)\n");
+        if ( reuseport && setsockopt(s, SOL_SOCKET, SO_REUSEPORT,
+                    (char*)&option,sizeof(option)) < 0)
+            printf("warning: setsockopt failed (SO_REUSEPORT)\n");
+#endif
+        // (ipv4 clients too, as ::ffff:a.b.c.d, whatever the system default)
+        if ( _p->ai_family == AF_INET6 && setsockopt(s, IPPROTO_IPV6, IPV6_V6ONLY,
+                    (char*)&v6only,sizeof(v6only)) < 0)
+            printf("warning: setsockopt failed (IPV6_V6ONLY)\n");
+        if ( tcp_nodelay ) {
+            if ( setsockopt(s,
+                        IPPROTO_TCP,     /* set option at TCP level */
+                        TCP_NODELAY,     /* name of option */
+                        (char*)&option,sizeof(option)) < 0 )
+                printf("warning: setsockopt failed (TCP_NODELAY)\n");
+        }
+
+        if (log>1) printf("SimpleHttp::start - bind ...\n");
+        iResult =  bind(s, _p->ai_addr, _p->ai_addrlen);
+        if ( iResult != 0 ) {
+            if (log>1) {
+                printf("SimpleHttp::start - bind(...) == %d != 0, (bind fails)\n",iResult);
+#ifdef MS_WINDOWS
+                if (iResult == SOCKET_ERROR)
+                    printf("bind failed with error %d\n", WSAGetLastError());
+#endif
+            }
+        }
+        // listen for incoming connections
+#ifdef MS_WINDOWS
+        else if ( listen (s, SOMAXCONN) == SOCKET_ERROR )
+            printf("listen failed with error: %d\n", WSAGetLastError());
+#else
+        else if ( listen (s, SOMAXCONN) != 0 )
+            perror("listen() error");
+#endif
+        else {
+            if (log>1) printf("SimpleHttp::start - bind(...) == 0, OK, stop\n");
+            break;
+        }
+#ifdef MS_WINDOWS
+        closesocket(s);
+#else
+        int e = errno;
+        CLOSE(s);
+        errno = e;
+#endif
+        s = INVALID_SOCKET;
+    }
+    freeaddrinfo(result);
+    return s;
+}
+
+
+/* \brief socket listening on l's unix domain socket path, or INVALID_SOCKET */
+SOCKET_TYPE SimpleHttp::openUnixSocket( listen_info &l )
+{
+#ifdef MS_WINDOWS
+    return INVALID_SOCKET;
+#else
+    struct sockaddr_un addr;
+    memset( &addr, 0, sizeof(addr) );
+    addr.sun_family = AF_UNIX;
+    strncpy( addr.sun_path, l.path.c_str(), sizeof(addr.sun_path) - 1 );
+
+    // something there already: only a socket nothing's accepting on
+    // (a server that's gone) is removed
+    struct stat st;
+    if ( lstat( l.path.c_str(), &st ) == 0 ) {
+        if ( ! S_ISSOCK( st.st_mode ) ) {
+            errno = EEXIST;
+            return INVALID_SOCKET;
+        }
+        int probe = socket( AF_UNIX, SOCK_STREAM, 0 );
+        if ( probe < 0 )
+            return INVALID_SOCKET;
+        set_nonblock( probe ); // (a live server's full backlog: EAGAIN, not a wait)
+        bool stale = connect( probe, (struct sockaddr *) &addr, sizeof(addr) ) != 0
+            && errno == ECONNREFUSED;
+        CLOSE( probe );
+        if ( ! stale ) {
+            errno = EADDRINUSE;
+            return INVALID_SOCKET;
+        }
+        if (log) printf("SimpleHttp::start - removing stale socket %s\n", l.path.c_str());
+        unlink( l.path.c_str() );
+    }
+
+    if (log>1) printf("SimpleHttp::start - unix socket %s ...\n", l.path.c_str());
+    SOCKET_TYPE s = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if ( s == SOCKET_ERROR )
+        return INVALID_SOCKET;
+    set_nonblock( s );
+    if ( bind( s, (struct sockaddr *) &addr, sizeof(addr) ) != 0 ) {
+        int e = errno;
+        CLOSE( s );
+        errno = e;
+        return INVALID_SOCKET;
+    }
+    l.owner = (int) getpid();
+    // (no one can connect until listen(), so set the mode in between)
+    if ( chmod( l.path.c_str(), (mode_t) l.mode ) != 0 || listen( s, SOMAXCONN ) != 0 ) {
+        int e = errno;
+        CLOSE( s );
+        unlink( l.path.c_str() );
+        l.owner = 0;
+        errno = e;
+        return INVALID_SOCKET;
+    }
+    return s;
+#endif
+}
+
+
+#ifndef MS_WINDOWS
+/* \brief fork worker process i; it runs its own event loop, until killed */
+void SimpleHttp::startWorker( int i )
+{
+    if (log) fflush(stdout);
+    pid_t supervisor = getpid();
+    pid_t pid = fork();
+    if ( pid < 0 ) {
+        perror("fork() error, worker not started");
+        return;
+    }
+    if ( pid > 0 ) {
+        worker_pids[i] = pid;
+        time( &worker_started[i] );
+        if (log>1) printf("SimpleHttp - worker %d: pid %d\n", i, (int)pid);
+        return;
+    }
+
+    // in the worker ...
+    worker_id = i;
+    worker_pids.clear();
+    worker_started.clear();
+    signal(SIGCHLD, SIG_IGN); // (handlers may fork; don't leave zombies)
+#ifdef __linux__
+    prctl( PR_SET_PDEATHSIG, SIGTERM ); // don't outlive the supervisor
+    if ( getppid() != supervisor )
+        _exit(0); // (it died before the prctl(), so no SIGTERM's coming)
+#else
+    (void) supervisor;
+#endif
+    if ( reuseport ) {
+        closeListeners( true );
+        if ( ! openListeners( true ) ) {
+            perror("worker: socket() or bind() problem");
+            _exit(1);
+        }
+    }
+    startBackend();
+    eventLoop();
+    fflush(stdout);
+    _exit(0); // (not exit(): the parent's atexit handlers and static
+              // destructors, a global SimpleHttp's say, aren't ours to run)
+}
+
+/* \brief reap dead workers and start replacements; returns number restarted */
+int SimpleHttp::superviseWorkers()
+{
+    int restarted = 0;
+    int wstatus;
+    // (each worker by pid: waitpid(-1) would reap, and lose the status of,
+    // the application's own children)
+    for (size_t i=0; i<worker_pids.size(); i++) {
+        if ( worker_pids[i] <= 0 )
+            continue;
+        pid_t pid = waitpid( worker_pids[i], &wstatus, WNOHANG );
+        if ( pid == 0 || ( pid < 0 && errno != ECHILD ) )
+            continue;
+        if (log) {
+            if ( pid < 0 ) // (SIGCHLD ignored: reaped already, no status)
+                printf("SimpleHttp - worker %d (pid %d) ended\n",
+                        (int)i, (int)worker_pids[i]);
+            else if ( WIFSIGNALED(wstatus) )
+                printf("SimpleHttp - worker %d (pid %d) killed by signal %d\n",
+                        (int)i, (int)pid, WTERMSIG(wstatus));
+            else
+                printf("SimpleHttp - worker %d (pid %d) exited, status %d\n",
+                        (int)i, (int)pid, WEXITSTATUS(wstatus));
+        }
+        worker_pids[i] = 0;
+    }
+    time_t now;
+    time( &now );
+    for (size_t i=0; i<worker_pids.size(); i++) {
+        // (don't spin on a worker that dies straight away)
+        if ( worker_pids[i] == 0 && now - worker_started[i] >= WORKER_RESTART_SECS ) {
+            startWorker( (int)i );
+            restarted++;
+        }
+    }
+    return restarted;
 }
 
+/* \brief stop (SIGTERM) and wait for the workers */
+void SimpleHttp::stopWorkers()
+{
+    for (size_t i=0; i<worker_pids.size(); i++)
+        if ( worker_pids[i] > 0 )
+            kill( worker_pids[i], SIGTERM );
+    for (size_t i=0; i<worker_pids.size(); i++)
+        if ( worker_pids[i] > 0 )
+            waitpid( worker_pids[i], NULL, 0 );
+    worker_pids.clear();
+    worker_started.clear();
+}
+#endif
+
 
 
 
@@ -321,16 +901,25 @@ void SimpleHttp::page( std::string route,
     if (log>1) printf("server callback: %s\n",route.c_str() );
 }
 
+/* \brief cache route's (a page callback's) responses: a GET with the same
+   parameters within ttl_ms gets the stored response, and concurrent
+   misses wait for the one response being made; 0 = don't cache.
+   n.b.: what the callback sends with http_send*() or SOCKET_SEND is
+   captured; a raw write() (or SOCKET_WRITE) bypasses the cache */
+void SimpleHttp::cache( std::string route, unsigned int ttl_ms )
+{
+#ifdef MS_WINDOWS
+    printf("warning: no response cache on windows, not caching %s\n", route.c_str());
+#else
+    if ( ttl_ms )
+        cache_ttl[ route ] = ttl_ms;
+    else
+        cache_ttl.erase( route );
+    if (log>1) printf("server cache: %s %u ms\n",route.c_str(), ttl_ms );
+#endif
+}
 
 
-// // get sockaddr, IPv4 or IPv6:
-// inline void * _get_in_addr(struct sockaddr *sa)
-// {
-//     if (sa->sa_family == AF_INET)
-//         return &(((struct sockaddr_in*)sa)->sin_addr);
-//     return &(((struct sockaddr_in6*)sa)->sin6_addr);
-// }
-
 
 /* \brief poll for and handle http server events (fork or thread)  */
 bool SimpleHttp::handleEvents()
@@ -343,88 +932,1299 @@ bool SimpleHttp::handleEvents()
         if (log) printf("handleEvents: status isn't STARTED (or SERVER_ERROR) so exiting now\n");
         return false;
     }
+#ifndef MS_WINDOWS
+    if ( ! worker_pids.empty() )
+        return processTimers() > 0;
+#endif
+    return pollEvents( 0 ) > 0;
+}
+
+
+/* \brief wait (up to timeout_ms, -1 = forever) for socket events and
+   handle them; returns the number of connections accepted or dispatched */
+int SimpleHttp::pollEvents( int timeout_ms )
+{
+#ifdef USE_IO_URING
+    if ( uring )
+        return pollUring( timeout_ms );
+#endif
+    std::vector< watch_fd > watch;
+    getFds( watch );
+    std::vector< struct pollfd > fds( watch.size() );
+    for (size_t i=0; i<watch.size(); i++) {
+        fds[i].fd = watch[i].fd;
+        fds[i].events = (short)( ( watch[i].events & EVENT_READ ? POLLIN : 0 )
+                               | ( watch[i].events & EVENT_WRITE ? POLLOUT : 0 ) );
+        fds[i].revents = 0;
+    }
+
+    long next = nextTimeout();
+    if ( next >= 0 && ( timeout_ms < 0 || next < timeout_ms ) )
+        timeout_ms = (int)next;
 
-    struct sockaddr_in clientaddr;  
-    struct hostent *hostp; /* client host info */
-    socklen_t addrlen;
+    int done = 0;
+    if ( fds.empty() ) { // (nothing open, start() failed, say: wait anyway, not spin)
+        usleep( 1000L * ( timeout_ms < 0 ? EVENT_LOOP_WAIT_MS : timeout_ms ) );
+        processTimers();
+        return 0;
+    }
+    int n = SOCKET_POLL( &fds[0], fds.size(), timeout_ms );
+    if ( n < 0 ) {
+#ifndef MS_WINDOWS
+        if ( errno != EINTR )
+            perror("poll() error");
+#else
+        if (log) printf("WSAPoll failed with error: %d\n", WSAGetLastError());
+#endif
+    }
+    for (size_t i=0; n>0 && i<fds.size(); i++) {
+        if ( fds[i].revents == 0 )
+            continue;
+        n--;
+        // (hangups and errors show up as a read: recv() says what happened)
+        int events = ( fds[i].revents & (POLLIN | POLLHUP | POLLERR) ? EVENT_READ : 0 )
+                   | ( fds[i].revents & POLLOUT ? EVENT_WRITE : 0 );
+        done += processReady( fds[i].fd, events, MAX_ACCEPTS_PER_POLL );
+    }
+    processTimers();
+    return done;
+}
 
-    addrlen = sizeof(clientaddr);
-    SOCKET_TYPE client_socket = accept(listen_socket,
-            (struct sockaddr *) &clientaddr, &addrlen);
 
+/* \brief the sockets the server needs watched, and for what (replaces
+   the contents of fds); for driving the server from a host event loop */
+int SimpleHttp::getFds( std::vector< watch_fd > &fds )
+{
+    fds.clear();
+    watch_fd w;
+#ifdef USE_IO_URING
+    if ( uring ) { // all i/o completes in the ring; its fd is readable when there's some
+        armUring();
+        uring->submit();
+        w.fd = uring->fd;
+        w.events = EVENT_READ;
+        fds.push_back( w );
+        return (int) fds.size();
+    }
+#endif
+    for (size_t i=0; i<listeners.size() && worker_pids.empty(); i++) {
+        if ( listeners[i].fd == INVALID_SOCKET )
+            continue;
+        w.fd = listeners[i].fd;
+        w.events = EVENT_READ;
+        fds.push_back( w );
+    }
+    for ( std::map< SOCKET_TYPE, http_conn * >::iterator i = conns.begin();
+            i != conns.end(); ++i ) {
+        w.fd = i->first;
+        if ( i->second->state == CONN_WRITE )
+            w.events = i->second->tls_want_read ? EVENT_READ : EVENT_WRITE;
+        else
+            w.events = EVENT_READ | ( i->second->tls_want_write ? EVENT_WRITE : 0 );
+        fds.push_back( w );
+    }
 #ifndef MS_WINDOWS
-    if ( client_socket<0 ) {
-        // something other than accepting a connection happened ....
-        if ( !(    (errno == EAGAIN )
-                || (errno == EWOULDBLOCK ) ) ) {
-            if (log) printf("handleEvents: accept returns %d, errno=%d\n",
-                    (int)client_socket,errno);
-            perror ("accept() error"); // was error, print
+    if ( rcache ) { // responses on their way to the cache
+        for ( std::map< int, cache_fill * >::iterator i = rcache->fill_fds.begin();
+                i != rcache->fill_fds.end(); ++i ) {
+            w.fd = i->first;
+            w.events = EVENT_READ;
+            fds.push_back( w );
         }
-        return false; // nothing done (but didn't block - not an error here)
     }
-#else
-    if ( client_socket == INVALID_SOCKET) {
-        int nError=WSAGetLastError();
-        if ( nError != WSAEWOULDBLOCK ) {
-            if (log) printf("accept failed with error: %d\n", WSAGetLastError());
+    if ( tpipe ) { // forked responders' traces
+        w.fd = tpipe->fd[0];
+        w.events = EVENT_READ;
+        fds.push_back( w );
+    }
+    if ( ws && ws->wake[0] >= 0 ) { // websockets, and the pipe that wakes us to send
+        w.fd = ws->wake[0];
+        w.events = EVENT_READ;
+        fds.push_back( w );
+        for ( std::map< SOCKET_TYPE, ws_conn * >::iterator i = ws->conns.begin();
+                i != ws->conns.end(); ++i ) {
+            w.fd = i->first;
+            w.events = EVENT_READ | ( i->second->out.empty() ? 0 : EVENT_WRITE );
+            fds.push_back( w );
         }
-        // = nothing done (but didn't block - not an error here)
-        return false;
     }
 #endif
+    return (int) fds.size();
+}
 
-    ///// connection accepted; client_socket /////
-
-    //char s[INET6_ADDRSTRLEN]; // IPv6 ?
-    //inet_ntop(_p->ai_family, _get_in_addr((struct sockaddr *) &clientaddr), s, sizeof s);
-    std::string ip_addr_str( inet_ntoa( ((struct sockaddr_in*)&clientaddr)->sin_addr ) );
-    time_t rawtime;
-    struct tm * timeinfo;
-    time ( &rawtime );
-    timeinfo = localtime ( &rawtime );
 
-    // gethostbyaddr: determine who sent the message 
-    hostp = gethostbyaddr((const char *)&clientaddr.sin_addr.s_addr,
-            sizeof(clientaddr.sin_addr.s_addr), AF_INET);
-    if ( hostp != NULL )
-        http_host = hostp->h_name;
+/* \brief handle events on one of the getFds() sockets, without blocking;
+   budget caps the work done (accepts, recvs or completions), a level
+   triggered caller gets called again for the rest.  Returns the number
+   of connections accepted or requests dispatched */
+int SimpleHttp::processReady( SOCKET_TYPE fd, int events, int budget )
+{
+    if ( budget <= 0 )
+        return 0;
+#ifndef MS_WINDOWS
+    if ( ws )
+        wsReap();
+#endif
+#ifdef USE_IO_URING
+    if ( uring && fd == uring->fd ) {
+        uring->wait( 0 );
+        return processUring( budget );
+    }
+#endif
+    for (size_t i=0; i<listeners.size(); i++)
+        if ( fd == listeners[i].fd )
+            return ( events & EVENT_READ ) ? acceptConnections( listeners[i], budget ) : 0;
+#ifndef MS_WINDOWS
+    if ( rcache && rcache->fill_fds.count( fd ) )
+        return ( events & EVENT_READ ) ? readFill( fd ) : 0;
+    if ( tpipe && fd == tpipe->fd[0] )
+        return ( events & EVENT_READ ) ? readTraces() : 0;
+    if ( ws ) {
+        if ( fd == ws->wake[0] )
+            return ( events & EVENT_READ ) ? wsWake() : 0;
+        std::map< SOCKET_TYPE, ws_conn * >::iterator w = ws->conns.find( fd );
+        if ( w != ws->conns.end() ) {
+            if ( ( events & EVENT_WRITE ) && ! wsFlush( w->second ) )
+                return 0;
+            return ( events & EVENT_READ ) ? wsRead( w->second, budget ) : 0;
+        }
+    }
+#endif
+    std::map< SOCKET_TYPE, http_conn * >::iterator c = conns.find( fd );
+    if ( c == conns.end() )
+        return 0; // (gone already)
+    if ( c->second->state == CONN_WRITE ) {
+        writeConnection( c->second );
+        return 0;
+    }
+    if ( !( events & EVENT_READ ) && !( ( events & EVENT_WRITE ) && c->second->tls_want_write ) )
+        return 0;
+    return readConnection( c->second, budget ) ? 1 : 0;
+}
 
-#define LOG_IT if (log) fprintf(stdout,"%d/%02d/%02d %02d:%02d:%02d|%s|%s", \
-        timeinfo->tm_year + 1900, timeinfo->tm_mon + 1,  timeinfo->tm_mday, \
-        timeinfo->tm_hour,  timeinfo->tm_min,  timeinfo->tm_sec, \
-        ip_addr_str.c_str(), http_host.c_str() )
 
-#ifdef USE_STD_THREAD
-    // pthreaded server (needs -lpthread )
-    LOG_IT;
-    std::thread client( &SimpleHttp::respond, this, client_socket );
-    client.detach();
-#else
-    // forking server
-    if ( fork()==0 ) {
-        // now we're in the child process ...
-        LOG_IT;
-        CLOSE( listen_socket ); // and/or shutdown ?
-        respond( client_socket );
-        exit(0);
-    }
-    // parent process continues:
-    CLOSE(client_socket);
+/* \brief ms until processTimers() has work, -1 if nothing's pending */
+long SimpleHttp::nextTimeout()
+{
+#ifndef MS_WINDOWS
+    if ( ! worker_pids.empty() )
+        return EVENT_LOOP_WAIT_MS; // (supervisor: check on the workers)
 #endif
-    return true; // accepted http socket request
+    return timers->nextTimeout();
 }
 
 
-//!> low-level socket send
-int SimpleHttp::http_send(SOCKET_TYPE client_socket, std::string s)
+/* \brief time out slow connections (or, supervisor: restart dead workers);
+   call when nextTimeout() is up */
+int SimpleHttp::processTimers()
 {
-    return int( SOCKET_SEND(client_socket, s.c_str(), s.size() ) );
+#ifndef MS_WINDOWS
+    if ( ! worker_pids.empty() )
+        return superviseWorkers();
+#endif
+    return expireTimers();
 }
 
-int SimpleHttp::http_send(SOCKET_TYPE client_socket, char *buf, size_t buf_size )
+
+#ifdef USE_IO_URING
+// io_uring user_data: operation, connection generation, fd
+#define URING_DATA(op,gen,fd)   ( ( (uint64_t)(op) << 56 ) \
+                                | ( (uint64_t)( (gen) & 0xffffff ) << 32 ) \
+                                | (uint32_t)(fd) )
+#define URING_OP(data)          ( (int)( (data) >> 56 ) )
+#define URING_GEN(data)         ( (unsigned int)( (data) >> 32 ) & 0xffffff )
+#define URING_FD(data)          ( (SOCKET_TYPE)(uint32_t)(data) )
+enum uring_op { URING_ACCEPT = 1, URING_RECV, URING_SEND, URING_SHUTDOWN,
+                URING_CLOSE, URING_CANCEL, URING_POLL };
+
+/* \brief pollEvents() for the io_uring backend: multishot accept on each
+   listen socket, multishot recv (into provided buffers) per connection */
+int SimpleHttp::pollUring( int timeout_ms )
 {
-    return int( SOCKET_SEND(client_socket, buf, buf_size ) );
+    armUring();
+    long next = timers->nextTimeout();
+    if ( next >= 0 && ( timeout_ms < 0 || next < timeout_ms ) )
+        timeout_ms = (int)next;
+    if ( uring->wait( timeout_ms ) < 0 && errno != EBUSY )
+        perror("io_uring_enter() error");
+
+    int done = processUring( -1 );
+    expireTimers();
+    return done;
+}
+
+/* \brief (re-)arm the multishot accepts, if need be */
+void SimpleHttp::armUring()
+{
+    for (size_t i=0; i<listeners.size(); i++) {
+        listen_info &l = listeners[i];
+        if ( l.fd == INVALID_SOCKET || l.accepting )
+            continue;
+        uring_prep_multishot_accept( uring->sqe(), l.fd,
+                URING_DATA( URING_ACCEPT, 0, l.fd ) );
+        l.accepting = true;
+    }
+    if ( tpipe && ! tpipe->armed ) {
+        uring_prep_poll( uring->sqe(), tpipe->fd[0], POLLIN,
+                URING_DATA( URING_POLL, 0, tpipe->fd[0] ) );
+        tpipe->armed = true;
+    }
+    if ( ws && ws->wake[0] >= 0 && ! ws->wake_armed ) {
+        uring_prep_poll( uring->sqe(), ws->wake[0], POLLIN,
+                URING_DATA( URING_POLL, 0, ws->wake[0] ) );
+        ws->wake_armed = true;
+    }
+}
+
+/* \brief handle (up to budget, -1 = all) io_uring completions */
+int SimpleHttp::processUring( int budget )
+{
+    int done = 0;
+    struct io_uring_cqe *cqe;
+    uint64_t woke_ns = trace_sink ? TimerWheel::now_ns() : 0; // (for the accepts' traces)
+    if ( ws )
+        wsReap();
+    while ( budget-- != 0 && ( cqe = uring->peek() ) != NULL ) {
+        uint64_t data = cqe->user_data;
+        int res = cqe->res;
+        unsigned int flags = cqe->flags;
+        uring->seen();
+
+        if ( URING_OP(data) == URING_ACCEPT ) {
+            listen_info *l = NULL;
+            for (size_t i=0; i<listeners.size(); i++)
+                if ( listeners[i].fd == URING_FD(data) )
+                    l = &listeners[i];
+            if ( l && !( flags & IORING_CQE_F_MORE ) )
+                l->accepting = false; // re-armed next time round
+            if ( res < 0 ) {
+                if ( res != -ECANCELED ) {
+                    errno = -res;
+                    perror("accept() error");
+                }
+                continue;
+            }
+            struct sockaddr_storage clientaddr;
+            socklen_t addrlen = sizeof(clientaddr);
+            memset( &clientaddr, 0, sizeof(clientaddr) );
+            getpeername( res, (struct sockaddr *) &clientaddr, &addrlen );
+            http_conn *c = addConnection( res, (struct sockaddr *) &clientaddr, l && l->https,
+                    woke_ns );
+            if ( c == NULL )
+                continue;
+            if ( c->ssl ) { // https: openssl reads (poll, then SSL_read, non-blocking)
+                set_nonblock( c->fd );
+                uring_prep_poll( uring->sqe(), c->fd, POLLIN,
+                        URING_DATA( URING_POLL, c->gen, c->fd ) );
+            }
+            else
+                uring_prep_multishot_recv( uring->sqe(), c->fd, IoUring::buf_group,
+                        URING_DATA( URING_RECV, c->gen, c->fd ) );
+            done++;
+            continue;
+        }
+        if ( URING_OP(data) == URING_POLL ) { // cache fill pipe, websocket wake or write, https read
+            int fd = (int) URING_FD(data);
+            std::map< SOCKET_TYPE, http_conn * >::iterator ci = conns.find( fd );
+            if ( ci != conns.end() && ci->second->state == CONN_WRITE
+                    && ( ci->second->gen & 0xffffff ) == URING_GEN(data) ) {
+                ci->second->write_armed = false;
+                writeConnection( ci->second );
+            }
+            else if ( ci != conns.end() && ci->second->ssl
+                    && ( ci->second->gen & 0xffffff ) == URING_GEN(data) ) {
+                unsigned int gen = ci->second->gen;
+                if ( readConnection( ci->second ) ) {
+                    done++;
+                    continue;
+                }
+                ci = conns.find( fd ); // (still reading? wait for more)
+                if ( ci != conns.end() && ci->second->gen == gen )
+                    uring_prep_poll( uring->sqe(), fd, ci->second->tls_want_write ? POLLOUT : POLLIN,
+                            URING_DATA( URING_POLL, gen, fd ) );
+            }
+            else if ( rcache && rcache->fill_fds.count( fd ) ) {
+                done += readFill( fd );
+                if ( rcache->fill_fds.count( fd ) ) // (more to come)
+                    uring_prep_poll( uring->sqe(), fd, POLLIN, URING_DATA( URING_POLL, 0, fd ) );
+            }
+            else if ( ws && fd == ws->wake[0] ) {
+                ws->wake_armed = false; // (re-armed next time round)
+                done += wsWake();
+            }
+            else if ( tpipe && fd == tpipe->fd[0] ) {
+                tpipe->armed = false;
+                readTraces();
+            }
+            else if ( ws && ws->conns.count( fd )
+                    && ( ws->conns[fd]->gen & 0xffffff ) == URING_GEN(data) ) {
+                ws->conns[fd]->write_armed = false;
+                wsFlush( ws->conns[fd] );
+            }
+            continue;
+        }
+        if ( URING_OP(data) != URING_RECV ) {
+            if ( res < 0 && log>2 ) printf("io_uring op %d on %d: %s\n",
+                    URING_OP(data), (int)URING_FD(data), strerror(-res) );
+            continue; // (send, shutdown, close, cancel)
+        }
+
+        // recv: data, end of stream or error for one connection
+        SOCKET_TYPE fd = URING_FD(data);
+        std::map< SOCKET_TYPE, ws_conn * >::iterator wi;
+        if ( ws && ( wi = ws->conns.find( fd ) ) != ws->conns.end()
+                && ( wi->second->gen & 0xffffff ) == URING_GEN(data) ) { // a websocket's
+            ws_conn *w = wi->second;
+            if ( flags & IORING_CQE_F_BUFFER ) {
+                unsigned int bid = flags >> IORING_CQE_BUFFER_SHIFT;
+                if ( res > 0 )
+                    w->in.append( uring->buffer( bid ), res );
+                uring->recycle( bid );
+            }
+            if ( res == 0 || ( res < 0 && res != -ENOBUFS ) ) {
+                wsClose( w, res == 0 ? NULL : "recv() error" );
+                continue;
+            }
+            if ( res > 0 && ! wsFrames( w ) )
+                continue; // (closed)
+            if ( !( flags & IORING_CQE_F_MORE ) )
+                uring_prep_multishot_recv( uring->sqe(), fd, IoUring::buf_group,
+                        URING_DATA( URING_RECV, w->gen, fd ) );
+            continue;
+        }
+        std::map< SOCKET_TYPE, http_conn * >::iterator i = conns.find( fd );
+        http_conn *c = ( i != conns.end() && ( i->second->gen & 0xffffff ) == URING_GEN(data)
+                && i->second->state != CONN_WRITE )
+            ? i->second : NULL; // else: a stale completion, connection's gone (or responding)
+        if ( flags & IORING_CQE_F_BUFFER ) {
+            unsigned int bid = flags >> IORING_CQE_BUFFER_SHIFT;
+            if ( c && res > 0 )
+                c->req.append( uring->buffer( bid ), res );
+            uring->recycle( bid );
+        }
+        if ( c == NULL )
+            continue;
+        if ( res == 0 ) {
+            closeConnection( c, "Client disconnected unexpectedly." );
+            continue;
+        }
+        if ( res < 0 && res != -ENOBUFS ) {
+            closeConnection( c, "recv() error" );
+            continue;
+        }
+        if ( res > 0 ) {
+            unsigned int gen = c->gen;
+            if ( parseRequest( c ) ) {
+                done++;
+                continue;
+            }
+            i = conns.find( fd ); // (parseRequest may have closed it)
+            if ( i == conns.end() || i->second->gen != gen )
+                continue;
+        }
+        if ( !( flags & IORING_CQE_F_MORE ) ) // multishot ended (e.g. out of buffers), re-arm
+            uring_prep_multishot_recv( uring->sqe(), c->fd, IoUring::buf_group,
+                    URING_DATA( URING_RECV, c->gen, c->fd ) );
+    }
+    return done;
+}
+#endif // USE_IO_URING
+
+
+/* \brief accept pending connections on listener l; they're read by the
+   event loop */
+int SimpleHttp::acceptConnections( listen_info &l, int budget )
+{
+    int accepted;
+    for ( accepted=0; accepted<budget; accepted++ ) {
+        struct sockaddr_storage clientaddr;  
+        socklen_t addrlen;
+
+        addrlen = sizeof(clientaddr);
+        memset( &clientaddr, 0, sizeof(clientaddr) );
+        uint64_t accept_ns = trace_sink ? TimerWheel::now_ns() : 0; // (its wait, not accept()'s)
+        SOCKET_TYPE client_socket = accept(l.fd,
+                (struct sockaddr *) &clientaddr, &addrlen);
+
+#ifndef MS_WINDOWS
+        if ( client_socket<0 ) {
+            // something other than accepting a connection happened ....
+            if ( !(    (errno == EAGAIN )
+                    || (errno == EWOULDBLOCK ) ) ) {
+                if (log) printf("handleEvents: accept returns %d, errno=%d\n",
+                        (int)client_socket,errno);
+                perror ("accept() error"); // was error, print
+            }
+            break; // nothing (more) to do (but didn't block - not an error here)
+        }
+#else
+        if ( client_socket == INVALID_SOCKET) {
+            int nError=WSAGetLastError();
+            if ( nError != WSAEWOULDBLOCK ) {
+                if (log) printf("accept failed with error: %d\n", WSAGetLastError());
+            }
+            // = nothing done (but didn't block - not an error here)
+            break;
+        }
+#endif
+
+        ///// connection accepted; client_socket /////
+        set_nonblock( client_socket );
+        addConnection( client_socket, (struct sockaddr *) &clientaddr, l.https, accept_ns );
+    }
+    return accepted;
+}
+
+
+// the trace of the request this thread is responding to, if sampled
+static thread_local http_trace *current_trace = NULL;
+
+//!> a request reached phase: fire the probe, timestamp its trace (if sampled)
+static inline void trace_mark( http_trace *trace, SOCKET_TYPE fd, int phase )
+{
+    PROBE2( phase, (int)fd, phase );
+    if ( trace )
+        trace->t[ phase ] = TimerWheel::now_ns();
+}
+
+/* \brief hand a finished request's trace to trace_sink */
+void SimpleHttp::traceDone( http_trace *trace )
+{
+    if ( trace == NULL )
+        return;
+#ifndef MS_WINDOWS
+    if ( tpipe && getpid() != tpipe->pid ) { // a forked responder: to the loop's process
+        char buf[ PIPE_BUF ];
+        trace_record r;
+        memset( &r, 0, sizeof(r) );
+        r.id = trace->id;
+        memcpy( r.t, trace->t, sizeof(r.t) );
+        r.fd = (int32_t) trace->fd;
+        r.cached = trace->cached;
+        r.route_len = (uint16_t) std::min( trace->route.size(), sizeof(buf) - sizeof(r) );
+        memcpy( buf, &r, sizeof(r) );
+        memcpy( buf + sizeof(r), trace->route.data(), r.route_len );
+        if ( write( tpipe->fd[1], buf, sizeof(r) + r.route_len ) < 0 && log>1 )
+            perror("trace pipe"); // (full: dropped)
+        delete trace;
+        return;
+    }
+#endif
+    if ( trace_sink )
+        (trace_sink)( this, trace, context );
+    delete trace;
+}
+
+
+#ifndef MS_WINDOWS
+/* \brief pass the traces forked responders have sent back to trace_sink */
+int SimpleHttp::readTraces()
+{
+    char buf[ PIPE_BUF * 4 ];
+    for (;;) {
+        int n = READ( tpipe->fd[0], buf, sizeof(buf) );
+        if ( n > 0 ) {
+            tpipe->in.append( buf, n );
+            continue;
+        }
+        if ( n < 0 && errno == EINTR )
+            continue;
+        break; // (EAGAIN: that's all for now)
+    }
+    size_t used = 0;
+    trace_record r;
+    while ( tpipe->in.size() - used >= sizeof(r) ) {
+        memcpy( &r, tpipe->in.data() + used, sizeof(r) );
+        if ( tpipe->in.size() - used < sizeof(r) + r.route_len )
+            break;
+        http_trace trace;
+        trace.id = r.id;
+        trace.fd = (SOCKET_TYPE) r.fd;
+        trace.cached = r.cached != 0;
+        memcpy( trace.t, r.t, sizeof(trace.t) );
+        trace.route.assign( tpipe->in.data() + used + sizeof(r), r.route_len );
+        used += sizeof(r) + r.route_len;
+        if ( trace_sink )
+            (trace_sink)( this, &trace, context );
+    }
+    tpipe->in.erase( 0, used );
+    return 0;
+}
+#endif
+
+
+/* \brief track a just accepted connection, until its request is read */
+http_conn * SimpleHttp::addConnection( SOCKET_TYPE client_socket, const struct sockaddr *clientaddr,
+        bool https, uint64_t accept_ns )
+{
+    static unsigned int conn_gen = 0;
+
+    ssl_st *ssl = NULL;
+#ifdef USE_OPENSSL
+    if ( https ) { // (the handshake's read along with the request)
+        ssl = SSL_new( tls_ctx );
+        if ( ssl == NULL || SSL_set_fd( ssl, (int) client_socket ) != 1 ) {
+            ERR_print_errors_fp( stdout );
+            SSL_free( ssl );
+# ifdef MS_WINDOWS
+            closesocket( client_socket );
+# else
+            CLOSE( client_socket );
+# endif
+            return NULL;
+        }
+        SSL_set_accept_state( ssl );
+    }
+#else
+    (void) https;
+#endif
+    http_conn *c = new http_conn;
+    c->ssl = ssl;
+    c->tls_want_write = false;
+    c->tls_want_read = false;
+    c->out_sent = 0;
+    c->file = -1;
+    c->write_armed = false;
+    c->fd = client_socket;
+    c->gen = ++conn_gen;
+    c->state = CONN_IDLE;
+    c->req_size = 0;
+    c->waiting_on = NULL;
+    c->trace = NULL;
+    trace_seq++;
+    if ( trace_sink && trace_seq % ( trace_sample ? trace_sample : 1 ) == 0 ) {
+        c->trace = new http_trace;
+        c->trace->id = trace_seq;
+        c->trace->fd = client_socket;
+        c->trace->cached = false;
+        memset( c->trace->t, 0, sizeof(c->trace->t) );
+    }
+    trace_mark( c->trace, client_socket, TRACE_ACCEPT );
+    if ( c->trace && accept_ns )
+        c->trace->t[ TRACE_ACCEPT ] = accept_ns;
+    time ( &c->accept_time );
+
+    // client's address: ipv4 (also as mapped by a dual-stack socket), ipv6,
+    // or a unix socket's (no address, nor host)
+    socklen_t addrlen = 0;
+    if ( clientaddr->sa_family == AF_INET )
+        addrlen = sizeof(struct sockaddr_in);
+    else if ( clientaddr->sa_family == AF_INET6 )
+        addrlen = sizeof(struct sockaddr_in6);
+    char name[ NI_MAXHOST ];
+    if ( addrlen == 0 )
+        c->ip_addr_str = "unix";
+    else if ( getnameinfo( clientaddr, addrlen, name, sizeof(name), NULL, 0, NI_NUMERICHOST ) == 0 ) {
+        c->ip_addr_str = name;
+        if ( c->ip_addr_str.compare( 0, 7, "::ffff:" ) == 0
+                && c->ip_addr_str.find( '.' ) != std::string::npos )
+            c->ip_addr_str.erase( 0, 7 );
+    }
+
+    // getnameinfo: determine who sent the message (n.b. blocks on dns)
+    if ( lookup_hosts && addrlen > 0
+            && getnameinfo( clientaddr, addrlen, name, sizeof(name), NULL, 0, NI_NAMEREQD ) == 0 )
+        c->host = name;
+    trace_mark( c->trace, client_socket, TRACE_RESOLVED );
+
+    c->timer.kind = IDLE_TIMEOUT;
+    c->timer.data = c;
+    if ( idle_timeout_ms )
+        timers->schedule( &c->timer, idle_timeout_ms );
+    conns[ client_socket ] = c;
+    if (log>2) printf("accepted %d, %d connection(s) reading\n",
+            (int)client_socket, (int)conns.size() );
+    return c;
+}
+
+
+//!> end of the http header in req (past the blank line), or 0 if not all in yet
+static size_t header_size( const std::string &req )
+{
+    size_t crlf = req.find( "\r\n\r\n" );
+    size_t lf = req.find( "\n\n" );
+    if ( crlf != std::string::npos && ( lf == std::string::npos || crlf < lf ) )
+        return crlf + 4;
+    if ( lf != std::string::npos )
+        return lf + 2;
+    return 0;
+}
+
+//!> value of the Content-Length header field into len (0 if none); false
+//!> if it's not a number (negative, say), or too big for a size_t
+static bool content_length( const std::string &req, size_t hdr_size, size_t &len )
+{
+    static const char field[] = "\ncontent-length:";
+    size_t n = sizeof(field) - 1;
+    len = 0;
+    for (size_t i=0; i+n<hdr_size; i++) {
+        if ( strncasecmp( req.c_str()+i, field, n ) != 0 )
+            continue;
+        const char *p = req.c_str()+i+n;
+        while ( *p == ' ' || *p == '\t' )
+            p++;
+        if ( *p < '0' || *p > '9' )
+            return false;
+        for ( ; *p >= '0' && *p <= '9'; p++) {
+            if ( len > ( (size_t)-1 - ( *p - '0' ) ) / 10 )
+                return false;
+            len = len * 10 + ( *p - '0' );
+        }
+        while ( *p == ' ' || *p == '\t' )
+            p++;
+        return *p == '\r' || *p == '\n';
+    }
+    return true;
+}
+
+
+#ifdef USE_OPENSSL
+//!> SSL_read(), as recv() on a non-blocking socket would: -1 with EAGAIN
+//!> when it has to wait (want_write: for the socket to be writable)
+static int tls_recv( SSL *ssl, char *buf, size_t len, bool &want_write )
+{
+    size_t n = 0;
+    ERR_clear_error();
+    want_write = false;
+    if ( SSL_read_ex( ssl, buf, len, &n ) == 1 )
+        return (int) n;
+    switch ( SSL_get_error( ssl, 0 ) ) {
+        case SSL_ERROR_WANT_WRITE:
+            want_write = true; // fall through
+        case SSL_ERROR_WANT_READ:
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_ZERO_RETURN: // (close_notify)
+            return 0;
+        case SSL_ERROR_SYSCALL:
+            if ( errno == 0 || errno == EAGAIN )
+                errno = ECONNRESET;
+            return -1;
+        default: // (handshake failed, etc)
+            errno = EPROTO;
+            return -1;
+    }
+}
+#endif
+
+/* \brief read what's available of a connection's request (poll backend,
+   and https connections) */
+bool SimpleHttp::readConnection( http_conn *c, int budget )
+{
+    char buf[ READ_BUF_SIZE * 16 ];
+    for ( ; budget > 0; budget-- ) {
+        int n;
+#ifdef USE_OPENSSL
+        if ( c->ssl ) {
+            n = tls_recv( c->ssl, buf, sizeof(buf), c->tls_want_write );
+            if ( n > 0 && c->req.empty() && log>1 )
+                printf("tls: %s %s%s%s\n", SSL_get_version( c->ssl ), SSL_get_cipher( c->ssl ),
+                        SSL_session_reused( c->ssl ) ? ", resumed" : "",
+                        BIO_get_ktls_send( SSL_get_wbio( c->ssl ) ) ? ", ktls" : "" );
+        }
+        else
+#endif
+        n = recv( c->fd, buf, sizeof(buf), 0 );
+        if ( n > 0 ) {
+            c->req.append( buf, n );
+            if ( c->req.size() > maxRecvBufferSize )
+                break;
+            continue;
+        }
+        if ( n == 0 ) {
+            closeConnection( c, "Client disconnected unexpectedly." );
+            return false;
+        }
+#ifndef MS_WINDOWS
+        if ( errno == EAGAIN || errno == EWOULDBLOCK )
+            break;
+        if ( errno == EINTR )
+            continue;
+#else
+        if ( WSAGetLastError() == WSAEWOULDBLOCK || ( c->ssl && errno == EAGAIN ) )
+            break;
+#endif
+#ifdef USE_OPENSSL
+        if ( c->ssl && log>1 )
+            ERR_print_errors_fp( stdout );
+#endif
+        closeConnection( c, c->ssl ? "tls error" : "recv() error" );
+        return false;
+    }
+    return parseRequest( c );
+}
+
+
+/* \brief advance a connection's read state with what's in c->req; once
+   the request is all in, dispatch it; returns true if dispatched */
+bool SimpleHttp::parseRequest( http_conn *c )
+{
+    if ( c->req.empty() )
+        return false;
+
+    if ( c->state == CONN_IDLE ) {
+        trace_mark( c->trace, c->fd, TRACE_FIRST_BYTE );
+        c->state = CONN_HEADER;
+        c->timer.kind = HEADER_TIMEOUT;
+        if ( header_timeout_ms )
+            timers->schedule( &c->timer, header_timeout_ms );
+        else
+            timers->cancel( &c->timer );
+    }
+    if ( c->state == CONN_HEADER ) {
+        size_t hdr_size = header_size( c->req );
+        if ( hdr_size == 0 ) {
+            if ( c->req.size() > maxRecvBufferSize )
+                closeConnection( c, "request header too large",
+                        "HTTP/1.0 413 Request Entity Too Large\n\n" );
+            return false;
+        }
+        size_t body_size;
+        if ( ! content_length( c->req, hdr_size, body_size ) ) {
+            closeConnection( c, "bad content-length",
+                    "HTTP/1.0 400 Bad Request\n\n" );
+            return false;
+        }
+        if ( hdr_size > maxRecvBufferSize || body_size > maxRecvBufferSize - hdr_size ) {
+            closeConnection( c, "request too large",
+                    "HTTP/1.0 413 Request Entity Too Large\n\n" );
+            return false;
+        }
+        c->req_size = hdr_size + body_size;
+        c->state = CONN_BODY;
+        c->timer.kind = BODY_TIMEOUT;
+        if ( body_timeout_ms )
+            timers->schedule( &c->timer, body_timeout_ms );
+        else
+            timers->cancel( &c->timer );
+    }
+    if ( c->req.size() < c->req_size )
+        return false; // more body to come
+
+    c->req.resize( c->req_size );
+    trace_mark( c->trace, c->fd, TRACE_READ );
+    dispatch( c );
+    return true;
+}
+
+
+/* \brief time out connections that are too slow to send their request */
+int SimpleHttp::expireTimers()
+{
+    std::vector< timer_node * > expired;
+    timers->expire( expired );
+    for (size_t i=0; i<expired.size(); i++) {
+        http_conn *c = (http_conn *) expired[i]->data;
+#ifndef MS_WINDOWS
+        if ( expired[i]->kind == FILL_TIMEOUT ) { // gave up waiting: respond the usual way
+            cache_fill *fill = c->waiting_on;
+            std::vector< http_conn * > &w = fill->waiters;
+            w.erase( std::find( w.begin(), w.end(), c ) );
+            c->waiting_on = NULL;
+            // (and don't park more behind it: the next miss makes its own)
+            std::map< std::string, cache_fill * >::iterator f = rcache->fills.find( fill->key );
+            if ( f != rcache->fills.end() && f->second == fill )
+                rcache->fills.erase( f );
+            handOff( c, NULL );
+            continue;
+        }
+#endif
+        if ( expired[i]->kind == IDLE_TIMEOUT )
+            closeConnection( c, "idle timeout" );
+        else if ( expired[i]->kind == SEND_TIMEOUT )
+            closeConnection( c, "send timeout" );
+        else
+            closeConnection( c, expired[i]->kind == HEADER_TIMEOUT
+                        ? "header timeout" : "body timeout",
+                    "HTTP/1.0 408 Request Timeout\n\n" );
+    }
+    return (int) expired.size();
+}
+
+
+/* \brief drop a connection before its request was dispatched */
+void SimpleHttp::closeConnection( http_conn *c, const char *why, const char *reply )
+{
+    if (log && why) printf("%s|%s - %s\n", c->ip_addr_str.c_str(), c->host.c_str(), why);
+    trace_mark( c->trace, c->fd, TRACE_DONE );
+    traceDone( c->trace );
+    timers->cancel( &c->timer );
+    conns.erase( c->fd );
+    if ( c->file >= 0 )
+        CLOSE( c->file );
+#ifdef USE_OPENSSL
+    if ( c->ssl ) { // (reply, if the handshake's done, without waiting; no close_notify)
+        if ( reply && SSL_is_init_finished( c->ssl ) )
+            SSL_write( c->ssl, reply, (int) strlen(reply) );
+        SSL_free( c->ssl );
+        reply = NULL;
+    }
+#endif
+#ifdef USE_IO_URING
+    if ( uring ) { // reply (a literal, so it outlives the send), then close
+        struct io_uring_sqe *s;
+        if ( reply ) {
+            s = uring->sqe();
+            uring_prep_send( s, c->fd, reply, strlen(reply),
+                    URING_DATA( URING_SEND, c->gen, c->fd ) );
+            s->flags |= IOSQE_IO_HARDLINK; // (close even if the send fails)
+        }
+        s = uring->sqe(); // shutdown also ends the multishot recv
+        uring_prep_shutdown( s, c->fd, URING_DATA( URING_SHUTDOWN, c->gen, c->fd ) );
+        s->flags |= IOSQE_IO_HARDLINK;
+        uring_prep_close( uring->sqe(), c->fd, URING_DATA( URING_CLOSE, c->gen, c->fd ) );
+        delete c;
+        return;
+    }
+#endif
+    if ( reply )
+        SOCKET_WRITE( c->fd, reply, strlen(reply) );
+#ifdef MS_WINDOWS
+    closesocket( c->fd );
+#else
+    shutdown( c->fd, SHUT_RDWR );
+    CLOSE( c->fd );
+#endif
+    delete c;
+}
+
+
+/* \brief a completely read request: serve it from the cache, or hand it
+   to a thread or child process */
+void SimpleHttp::dispatch( http_conn *c )
+{
+    timers->cancel( &c->timer );
+    conns.erase( c->fd );
+#ifndef MS_WINDOWS
+    if ( ws && wsUpgrade( c ) ) // (the loop keeps reading websockets)
+        return;
+#endif
+#ifdef USE_IO_URING
+    if ( uring ) { // stop the loop's multishot recv before the responder takes over
+        uring_prep_cancel( uring->sqe(), URING_DATA( URING_RECV, c->gen, c->fd ),
+                URING_DATA( URING_CANCEL, c->gen, c->fd ) );
+        uring->submit();
+    }
+#endif
+#ifndef MS_WINDOWS
+    if ( ! cache_ttl.empty() && cacheDispatch( c ) )
+        return;
+#endif
+    handOff( c, NULL );
+}
+
+
+// response capture, for cached routes and inline responses: sends to
+// capture_fd (from this thread) go to capture_buf instead
+static thread_local SOCKET_TYPE capture_fd = INVALID_SOCKET;
+static thread_local std::string *capture_buf = NULL;
+static thread_local http_conn *capture_conn = NULL; //!< inline: files are left to its loop
+
+#ifdef USE_OPENSSL
+// the https connection this thread is responding on: sends to tls_fd go
+// through openssl (which, with ktls, writes them as is for the kernel to
+// encrypt)
+static thread_local SOCKET_TYPE tls_fd = INVALID_SOCKET;
+static thread_local SSL *tls_ssl = NULL;
+#endif
+
+#define LOG_IT if (log) fprintf(stdout,"%d/%02d/%02d %02d:%02d:%02d|%s|%s", \
+        timeinfo->tm_year + 1900, timeinfo->tm_mon + 1,  timeinfo->tm_mday, \
+        timeinfo->tm_hour,  timeinfo->tm_min,  timeinfo->tm_sec, \
+        ip_addr_str.c_str(), http_host.c_str() )
+
+/* \brief respond to c's request in a thread or child process (or this
+   thread); with fill, the response also goes to the cache */
+void SimpleHttp::handOff( http_conn *c, cache_fill *fill )
+{
+    SOCKET_TYPE client_socket = c->fd;
+    std::string req;
+    req.swap( c->req );
+    std::string ip_addr_str = c->ip_addr_str;
+    http_host = c->host;
+    struct tm * timeinfo = localtime ( &c->accept_time );
+    http_trace *trace = c->trace;
+    ssl_st *ssl = c->ssl; // (the responder's, to send on and free)
+
+    if ( worker_id >= 0 || inline_dispatch ) {
+        // pre-forked worker, or embedded: respond in this thread, into a
+        // buffer the event loop sends from as the socket takes it
+        LOG_IT;
+        std::string response;
+        current_trace = trace;
+        trace_mark( trace, client_socket, TRACE_START );
+        capture_fd = client_socket;
+        capture_buf = &response;
+        capture_conn = c;
+        serve( client_socket, req );
+        capture_conn = NULL;
+        capture_buf = NULL;
+        capture_fd = INVALID_SOCKET;
+        current_trace = NULL;
+        writeResponse( c, response ); // (c's the event loop's again)
+#ifndef MS_WINDOWS
+        if ( fill )
+            completeFill( fill, response, true );
+#endif
+        return;
+    }
+    delete c;
+
+    // responders write with blocking sends, each bounded by send_timeout_ms
+    set_nonblock( client_socket, false );
+    if ( send_timeout_ms ) {
+#ifdef MS_WINDOWS
+        DWORD tv = send_timeout_ms;
+#else
+        struct timeval tv;
+        tv.tv_sec = send_timeout_ms / 1000;
+        tv.tv_usec = ( send_timeout_ms % 1000 ) * 1000;
+#endif
+        if ( setsockopt( client_socket, SOL_SOCKET, SO_SNDTIMEO,
+                    (char*)&tv, sizeof(tv) ) < 0 )
+            printf("warning: setsockopt failed (SO_SNDTIMEO)\n");
+    }
+
+    int fill_fd = -1;
+#ifndef MS_WINDOWS
+    if ( fill )
+        fill_fd = fill->write_fd;
+#endif
+#ifdef USE_STD_THREAD
+    // pthreaded server (needs -lpthread )
+    LOG_IT;
+    std::thread client( &SimpleHttp::responder, this, client_socket, req, trace,
+            ssl, fill_fd );
+    client.detach();
+# ifndef MS_WINDOWS
+    if ( fill )
+        fill->write_fd = -1; // (the thread closes it)
+# endif
+#else
+    // forking server
+    if ( trace && tpipe == NULL ) { // (the children's traces come back by pipe)
+        tpipe = new trace_pipe;
+        if ( pipe( tpipe->fd ) != 0 ) {
+            perror("pipe() error, no traces from children");
+            delete tpipe;
+            tpipe = NULL;
+        }
+        else {
+            set_nonblock( tpipe->fd[0] );
+            set_nonblock( tpipe->fd[1] ); // (a child drops its trace, rather than wait)
+            tpipe->pid = getpid();
+        }
+    }
+    if (log) fflush(stdout); // (don't have the child repeat buffered output)
+    if ( fork()==0 ) {
+        // now we're in the child process ...
+        LOG_IT;
+        for (size_t i=0; i<listeners.size(); i++)
+            if ( listeners[i].fd != INVALID_SOCKET )
+                CLOSE( listeners[i].fd ); // (the unix socket's file stays, the parent's)
+#ifdef USE_IO_URING
+        if ( uring )
+            CLOSE( uring->fd ); // (the ring's mapping is shared: hands off)
+#endif
+        responder( client_socket, req, trace, ssl, fill_fd );
+        fflush(stdout);
+        _exit(0); // (see startWorker())
+    }
+    // parent process continues:
+    CLOSE(client_socket);
+    delete trace; // (the child's copy goes to trace_sink)
+#ifdef USE_OPENSSL
+    SSL_free( ssl ); // (and its tls state, which has moved on in the child)
+#endif
+    if ( fill ) {
+        CLOSE( fill->write_fd ); // (the child's now; EOF when it's done)
+        fill->write_fd = -1;
+    }
+#endif
+}
+
+#ifdef USE_OPENSSL
+//!> SSL_write(), as send() on a non-blocking socket would: -1 with EAGAIN
+//!> when it has to wait (want_read: for the socket to be readable)
+static int tls_send( SSL *ssl, const char *buf, size_t len, bool &want_read )
+{
+    size_t n = 0;
+    ERR_clear_error();
+    want_read = false;
+    if ( SSL_write_ex( ssl, buf, len, &n ) == 1 )
+        return (int) n;
+    switch ( SSL_get_error( ssl, 0 ) ) {
+        case SSL_ERROR_WANT_READ:
+            want_read = true; // fall through
+        case SSL_ERROR_WANT_WRITE:
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_SYSCALL:
+            if ( errno == 0 || errno == EAGAIN )
+                errno = EPIPE;
+            return -1;
+        default:
+            errno = EPROTO;
+            return -1;
+    }
+}
+#endif
+
+#ifndef MS_WINDOWS
+//!> send (some of) c's file, from c->file_off, without blocking: sendfile(),
+//!> or SSL_sendfile() if the kernel does the tls; -1 with errno (EAGAIN:
+//!> wait), or 0 if it can't (read and send it) or the file's ended
+static int file_send( http_conn *c )
+{
+    size_t size = (size_t)( c->file_size - c->file_off );
+# ifdef __linux__
+#  ifdef USE_OPENSSL
+    if ( c->ssl ) {
+        if ( ! BIO_get_ktls_send( SSL_get_wbio( c->ssl ) ) )
+            return 0;
+        ERR_clear_error();
+        c->tls_want_read = false;
+        ossl_ssize_t n = SSL_sendfile( c->ssl, c->file, c->file_off, size, 0 );
+        if ( n > 0 ) {
+            c->file_off += n;
+            return (int) n;
+        }
+        switch ( SSL_get_error( c->ssl, (int) n ) ) {
+            case SSL_ERROR_WANT_READ:
+                c->tls_want_read = true; // fall through
+            case SSL_ERROR_WANT_WRITE:
+                errno = EAGAIN;
+                break;
+            default:
+                if ( errno == 0 || errno == EAGAIN )
+                    errno = EPIPE;
+        }
+        return -1;
+    }
+#  endif
+    ssize_t n = sendfile( c->fd, c->file, &c->file_off, size );
+    if ( n < 0 && ( errno == EINVAL || errno == ENOSYS ) )
+        return 0; // (not a file sendfile takes)
+    return (int) n;
+# else
+    (void) size;
+    return 0;
+# endif
+}
+#endif
+
+/* \brief send c's response from the event loop, without blocking: what
+   the socket won't take now is queued, and sent as it drains (with no
+   progress for send_timeout_ms, c's dropped); then c's closed */
+void SimpleHttp::writeResponse( http_conn *c, const std::string &response )
+{
+    c->state = CONN_WRITE;
+    c->out.clear();
+    c->out_sent = 0;
+    conns[ c->fd ] = c;
+    set_nonblock( c->fd );
+    c->timer.kind = SEND_TIMEOUT;
+    if ( send_timeout_ms )
+        timers->schedule( &c->timer, send_timeout_ms );
+    writeConnection( c, response.data(), response.size() );
+}
+
+/* \brief send what's queued of c's response, then data (len bytes; what
+   doesn't go now is queued), then c's file, as far as the socket takes
+   it; once it's all sent, close c.  Returns false if c's closed */
+bool SimpleHttp::writeConnection( http_conn *c, const char *data, size_t len )
+{
+    for (;;) {
+        bool queued = c->out_sent < c->out.size();
+        const char *buf = queued ? c->out.data() + c->out_sent : data;
+        size_t size = queued ? c->out.size() - c->out_sent : len;
+        int n;
+        if ( size == 0 ) {
+#ifndef MS_WINDOWS
+            if ( c->file < 0 || c->file_off >= c->file_size )
+                break;
+            n = file_send( c );
+            if ( n == 0 ) { // (can't sendfile: send it a piece at a time)
+                char piece[ READ_BUF_SIZE * 16 ];
+                ssize_t r = pread( c->file, piece, sizeof(piece), c->file_off );
+                if ( r <= 0 ) {
+                    c->file_off = c->file_size; // (it shrank, or can't be read)
+                    continue;
+                }
+                c->file_off += r;
+                c->out.assign( piece, r );
+                c->out_sent = 0;
+                continue;
+            }
+#else
+            break;
+#endif
+        }
+#ifdef USE_OPENSSL
+        else if ( c->ssl )
+            n = tls_send( c->ssl, buf, size, c->tls_want_read );
+#endif
+        else
+            n = int( SOCKET_WRITE( c->fd, buf, size ) );
+        if ( n > 0 ) {
+            if ( queued )
+                c->out_sent += n;
+            else if ( size > 0 ) {
+                data += n;
+                len -= n;
+            }
+            if ( send_timeout_ms )
+                timers->schedule( &c->timer, send_timeout_ms );
+            continue;
+        }
+#ifndef MS_WINDOWS
+        if ( n < 0 && errno == EINTR )
+            continue;
+        bool blocked = n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK );
+#else
+        bool blocked = n < 0 && ( WSAGetLastError() == WSAEWOULDBLOCK
+                || ( c->ssl && errno == EAGAIN ) );
+#endif
+        if ( ! blocked ) {
+            closeConnection( c, "send() error" );
+            return false;
+        }
+        // socket buffer's full: keep the rest for when it's writable
+        if ( ! queued && len > 0 ) {
+            c->out.assign( data, len );
+            c->out_sent = 0;
+        }
+#ifdef USE_IO_URING
+        if ( uring && ! c->write_armed ) {
+            uring_prep_poll( uring->sqe(), c->fd, c->tls_want_read ? POLLIN : POLLOUT,
+                    URING_DATA( URING_POLL, c->gen, c->fd ) );
+            c->write_armed = true;
+        }
+#endif
+        return true;
+    }
+
+    // all sent
+    timers->cancel( &c->timer );
+    conns.erase( c->fd );
+    if ( c->file >= 0 )
+        CLOSE( c->file );
+    SOCKET_TYPE client_socket = c->fd;
+    http_trace *trace = c->trace;
+#ifdef USE_OPENSSL
+    if ( c->ssl ) { // (endResponse's close_notify, and free)
+        tls_fd = client_socket;
+        tls_ssl = c->ssl;
+    }
+#endif
+    delete c;
+    current_trace = trace;
+    endResponse( client_socket );
+    current_trace = NULL;
+    traceDone( trace );
+    return false;
+}
+
+//!> send on a client socket (in the clear, or by this thread's tls), or
+//!> to the response being captured
+static int sock_send( SOCKET_TYPE fd, const char *buf, size_t len )
+{
+    if ( capture_buf && fd == capture_fd ) {
+        capture_buf->append( buf, len );
+        return int( len );
+    }
+#ifdef USE_OPENSSL
+    if ( tls_ssl && fd == tls_fd ) {
+        size_t n = 0;
+        if ( len == 0 )
+            return 0;
+        return SSL_write_ex( tls_ssl, buf, len, &n ) == 1 ? (int) n : -1;
+    }
+#endif
+    return int( SOCKET_WRITE( fd, buf, len ) );
+}
+
+//!> low-level socket send
+int SimpleHttp::socket_send( SOCKET_TYPE client_socket, const char *buf, size_t len )
+{
+    return sock_send( client_socket, buf, len );
+}
+
+int SimpleHttp::http_send(SOCKET_TYPE client_socket, std::string s)
+{
+    return sock_send( client_socket, s.c_str(), s.size() );
+}
+
+int SimpleHttp::http_send(SOCKET_TYPE client_socket, char *buf, size_t buf_size )
+{
+    return sock_send( client_socket, buf, buf_size );
+}
+
+//!> send all of buf (blocking socket), or fail
+static bool send_all( SOCKET_TYPE fd, const char *buf, size_t len )
+{
+    while ( len > 0 ) {
+        int n = sock_send( fd, buf, len );
+        if ( n <= 0 ) {
+#ifndef MS_WINDOWS
+            if ( n < 0 && errno == EINTR )
+                continue;
+#endif
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+//!> send all of file fd (size bytes) without copying it through here:
+//!> sendfile(), or SSL_sendfile() if the kernel does the tls; false, with
+//!> nothing sent, if it can't (windows, tls in openssl, etc)
+static bool send_file( SOCKET_TYPE sock, int fd, off_t size )
+{
+    if ( capture_buf && sock == capture_fd ) {
+#ifndef MS_WINDOWS
+        // responding inline: the event loop sends it, after what's captured
+        // (nothing's sent after a file), as the client takes it
+        if ( capture_conn && capture_conn->file < 0
+                && ( capture_conn->file = dup( fd ) ) >= 0 ) {
+            capture_conn->file_off = 0;
+            capture_conn->file_size = size;
+            return true;
+        }
+#endif
+        return false;
+    }
+#ifdef __linux__
+    off_t off = 0;
+# ifdef USE_OPENSSL
+    if ( tls_ssl && sock == tls_fd ) {
+        if ( ! BIO_get_ktls_send( SSL_get_wbio( tls_ssl ) ) )
+            return false;
+        while ( off < size ) {
+            ossl_ssize_t n = SSL_sendfile( tls_ssl, fd, off, size - off, 0 );
+            if ( n <= 0 )
+                break;
+            off += n;
+        }
+        return true;
+    }
+# endif
+    while ( off < size ) {
+        ssize_t n = sendfile( sock, fd, &off, size - off );
+        if ( n < 0 && errno == EINTR )
+            continue;
+        if ( n <= 0 ) {
+            if ( off == 0 && ( errno == EINVAL || errno == ENOSYS ) )
+                return false; // (not a file sendfile takes: read and send it)
+            break;
+        }
+    }
+    return true;
+#else
+    return false;
+#endif
 }
 
 //!> http header
@@ -439,18 +2239,57 @@ int SimpleHttp::http_send_ok(SOCKET_TYPE client_socket, std::string header )
 }
 
 
-//!> client connection
+/* \brief respond (in a responder thread/process), over ssl if https;
+   with fill_fd, capture the response for the cache: it goes to the
+   client, then down the fill pipe fill_fd */
+void SimpleHttp::responder( SOCKET_TYPE client_socket, std::string req,
+        http_trace *trace, ssl_st *ssl, int fill_fd )
+{
+#ifdef USE_OPENSSL
+    if ( ssl ) {
+        tls_fd = client_socket;
+        tls_ssl = ssl;
+    }
+#else
+    (void) ssl;
+#endif
+    current_trace = trace;
+    trace_mark( trace, client_socket, TRACE_START );
+    if ( fill_fd < 0 ) {
+        serve( client_socket, req );
+        endResponse( client_socket );
+        current_trace = NULL;
+        traceDone( trace );
+        return;
+    }
+
+    std::string response;
+    capture_fd = client_socket;
+    capture_buf = &response;
+    serve( client_socket, req );
+    capture_buf = NULL;
+    capture_fd = INVALID_SOCKET;
+
+    send_all( client_socket, response.data(), response.size() );
+    endResponse( client_socket );
+    current_trace = NULL;
+    traceDone( trace );
+    uint64_t len = response.size();
+    if ( ! send_all( fill_fd, (const char *)&len, sizeof(len) )
+            || ! send_all( fill_fd, response.data(), response.size() ) )
+        perror("response cache: write to fill pipe");
+    CLOSE( fill_fd );
+}
+
+
+//!> client connection: read (one recv) a request, then respond
 void SimpleHttp::respond( SOCKET_TYPE client_socket )
 {
-    char *reqline[3];
-    int inDataLength, bytes_read;
+    int inDataLength;
 
     //char mesg[maxRecvBufferSize];
     std::string mesg_str( maxRecvBufferSize, ' ' );
 
-
-    if (log>2) printf("respond %d\n",client_socket);
-
     memset( (void*)mesg_str.c_str(), (int)'\0', maxRecvBufferSize );
 
     inDataLength = recv( client_socket, (char *)mesg_str.c_str(), maxRecvBufferSize, 0);
@@ -477,18 +2316,46 @@ void SimpleHttp::respond( SOCKET_TYPE client_socket )
     }
 #endif
     else  // message recieved ok
+        mesg_str.resize( inDataLength );
+    if ( inDataLength <= 0 )
+        mesg_str.clear();
+    respond( client_socket, mesg_str );
+}
+
+
+//!> client connection: respond to request req (read from the client already)
+void SimpleHttp::respond( SOCKET_TYPE client_socket, std::string req )
+{
+    serve( client_socket, req );
+    endResponse( client_socket );
+}
+
+
+//!> route request req, send the response (the socket's left open)
+void SimpleHttp::serve( SOCKET_TYPE client_socket, std::string req )
+{
+    char *reqline[3];
+    int bytes_read;
+
+    if (log>2) printf("respond %d\n",client_socket);
+
+    std::string mesg_str( req ); // tokenized in place, below
+    mesg_str.push_back( '\0' );
+
+    if ( req.size() > 0 ) // message recieved ok
     {
         reqline[0] = strtok( (char *)mesg_str.c_str(), " \t\n");
-        bool is_get = strncmp(reqline[0], "GET\0", 4)==0;
-        bool is_post = strncmp(reqline[0], "POST\0", 5)==0 ;
+        bool is_get = reqline[0] && strncmp(reqline[0], "GET\0", 4)==0;
+        bool is_post = reqline[0] && strncmp(reqline[0], "POST\0", 5)==0 ;
         if ( is_get || is_post ) 
         {   // get or post:
-            if (log>1) printf("%s", mesg_str.c_str());
+            if (log>1) printf("%s", req.c_str());
             reqline[1] = strtok (NULL, " \t");
             reqline[2] = strtok (NULL, " \t\n");
-            if ( strncmp( reqline[2], "HTTP/1.0", 8)!=0
-                    && strncmp( reqline[2], "HTTP/1.1", 8)!=0 ) {
-                SOCKET_SEND(client_socket, "HTTP/1.0 400 Bad Request\n", 25);
+            if ( reqline[1] == NULL || reqline[2] == NULL
+                    || ( strncmp( reqline[2], "HTTP/1.0", 8)!=0
+                      && strncmp( reqline[2], "HTTP/1.1", 8)!=0 ) ) {
+                sock_send(client_socket, "HTTP/1.0 400 Bad Request\n", 25);
             }
             else {
                 if (log==1 && is_get ) printf(" %s",reqline[1] );
@@ -505,16 +2372,17 @@ void SimpleHttp::respond( SOCKET_TYPE client_socket )
                         route.resize( found );
                 }
 // see http://code.tutsplus.com/tutorials/http-headers-for-dummies--net-8039
+                trace_mark( current_trace, client_socket, TRACE_ROUTED );
+                PROBE2( route, (int)client_socket, route.c_str() );
+                if ( current_trace )
+                    current_trace->route = route;
                 if ( page_funct.find( route ) != page_funct.end() ) {
                     SIMPLEHTTP_CALLBACK handle 
                         = page_funct[route];
                     if (log>2) printf("   handle \"%s\" with callback\n", route.c_str());
                     (handle)( this, client_socket, route,
-                              (is_get ?&params :NULL),        // mesg maybe not null terminated:
-                              (is_post 
-                               // ? std::string(reinterpret_cast<char*>(mesg), inDataLength)
-                               ? std::string(mesg_str, inDataLength)
-                               : std::string() ),
+                              (is_get ?&params :NULL),        // req not null terminated:
+                              (is_post ? req : std::string() ),
                               context );
                 }
                 else
@@ -524,7 +2392,7 @@ void SimpleHttp::respond( SOCKET_TYPE client_socket )
                         http_send_ok( client_socket, pg.header );
                         if ( pg.type == CONTENT ) {
                             if (log>2) printf("   CONTENT\n");
-                            SOCKET_SEND( client_socket, pg.content.c_str(), pg.content.size() );
+                            sock_send( client_socket, pg.content.c_str(), pg.content.size() );
                         }
                         else
                         if ( pg.type == FILENAME ) {
@@ -537,18 +2405,24 @@ void SimpleHttp::respond( SOCKET_TYPE client_socket )
 #endif
                                             ) ) != -1 ) 
                             {
-                                char data_to_send[READ_BUF_SIZE];
+                                char data_to_send[READ_BUF_SIZE * 16]; // (a whole tls record)
+                                struct stat st;
                                 if (log>3) printf("   open ok\n");
-                                while ( ( bytes_read = READ(fd, data_to_send, READ_BUF_SIZE)) > 0 ) {
+                                if ( fstat( fd, &st ) == 0 && S_ISREG( st.st_mode )
+                                        && send_file( client_socket, fd, st.st_size ) ) {
+                                    if (log>4) printf("   sendfile %ld bytes\n", (long)st.st_size);
+                                }
+                                else
+                                while ( ( bytes_read = READ(fd, data_to_send, sizeof(data_to_send))) > 0 ) {
                                     if (log>4) printf("   read %d bytes\n",bytes_read);
-                                    SOCKET_SEND(client_socket, data_to_send, bytes_read);
+                                    sock_send(client_socket, data_to_send, bytes_read);
                                 }
                                 CLOSE(fd);
                             }
                             else {
                                 printf("   %s - can't open...\n", pg.filename.c_str());
                                 perror("can't open pg.filename ...");
-#define NOT_FOUND_404   SOCKET_SEND(client_socket, "HTTP/1.0 404 File Not Found\n", 23)
+#define NOT_FOUND_404   sock_send(client_socket, "HTTP/1.0 404 File Not Found\n", 23)
                                 NOT_FOUND_404;
                             }
                         }
@@ -557,16 +2431,31 @@ void SimpleHttp::respond( SOCKET_TYPE client_socket )
                         if (log) printf("   \"%s\" - not found", route.c_str());
                         NOT_FOUND_404;
                     }
+                trace_mark( current_trace, client_socket, TRACE_HANDLED );
             }
         }
     }
-    
+}
+
+
+//!> done responding: close the connection
+void SimpleHttp::endResponse( SOCKET_TYPE client_socket )
+{
+#ifdef USE_OPENSSL
+    if ( tls_ssl && client_socket == tls_fd ) { // close_notify, then done with it
+        SSL_shutdown( tls_ssl );
+        SSL_free( tls_ssl );
+        tls_ssl = NULL;
+        tls_fd = INVALID_SOCKET;
+    }
+#endif
 #ifdef MS_WINDOWS
     closesocket(client_socket);
 #else
     shutdown (client_socket, SHUT_RDWR);
     CLOSE(client_socket);
 #endif
+    trace_mark( current_trace, client_socket, TRACE_DONE );
     if (log>1) {
         printf("   respond() - done.\n\n");
     } else
@@ -576,6 +2465,706 @@ void SimpleHttp::respond( SOCKET_TYPE client_socket )
 
 
 
+#ifndef MS_WINDOWS
+/////////////////////////////////////////
+// response cache
+
+//!> escape what separates key parts
+static std::string cache_key_escape( const std::string &s )
+{
+    std::string e;
+    for (size_t i=0; i<s.size(); i++) {
+        if ( s[i] == '%' || s[i] == '&' || s[i] == '=' ) {
+            char hex[4];
+            snprintf( hex, sizeof(hex), "%%%02X", (unsigned char)s[i] );
+            e += hex;
+        } else
+            e += s[i];
+    }
+    return e;
+}
+
+/* \brief if req is a GET of a cached callback route, its cache key (the
+   route, then its parameters in order) and ttl */
+bool SimpleHttp::cacheKey( const std::string &req, std::string &key, unsigned int &ttl_ms )
+{
+    if ( req.compare( 0, 4, "GET " ) != 0 )
+        return false;
+    size_t end = req.find_first_of( " \t\r\n", 4 );
+    if ( end == std::string::npos || req.compare( end, 8, " HTTP/1." ) != 0 )
+        return false;
+    std::string url = req.substr( 4, end - 4 );
+    std::string route = url.substr( 0, url.find( '?' ) );
+    std::map< std::string, unsigned int >::iterator t = cache_ttl.find( route );
+    if ( t == cache_ttl.end() || page_funct.find( route ) == page_funct.end() )
+        return false;
+
+    std::map <std::string, std::string> params;
+    parseUrlKeyValuePairs( url, params, true );
+    key = route;
+    for ( std::map< std::string, std::string >::iterator i = params.begin();
+            i != params.end(); ++i )
+        key += ( i == params.begin() ? "?" : "&" )
+            + cache_key_escape( i->first ) + "=" + cache_key_escape( i->second );
+    ttl_ms = t->second;
+    return true;
+}
+
+/* \brief serve c from the cache, or park it behind a fill already under
+   way, or start one; false if c isn't cacheable (respond as usual) */
+bool SimpleHttp::cacheDispatch( http_conn *c )
+{
+    std::string key;
+    unsigned int ttl_ms;
+    if ( ! cacheKey( c->req, key, ttl_ms ) )
+        return false;
+    if ( rcache == NULL )
+        rcache = new response_cache;
+
+    std::map< std::string, cache_entry >::iterator e = rcache->entries.find( key );
+    if ( e != rcache->entries.end() ) {
+        if ( e->second.expires_ms > TimerWheel::now_ms() ) { // hit
+            rcache->lru.splice( rcache->lru.begin(), rcache->lru, e->second.lru );
+            sendCached( c, e->second.response, key );
+            return true;
+        }
+        cacheErase( key );
+    }
+
+    std::map< std::string, cache_fill * >::iterator f = rcache->fills.find( key );
+    if ( f != rcache->fills.end() ) { // someone's making it: wait for that
+        c->waiting_on = f->second;
+        f->second->waiters.push_back( c );
+        c->timer.kind = FILL_TIMEOUT;
+        timers->schedule( &c->timer, send_timeout_ms ? send_timeout_ms : FILL_WAIT_MS );
+        return true;
+    }
+
+    // miss: this request makes it
+    cache_fill *fill = new cache_fill;
+    fill->key = key;
+    fill->ttl_ms = ttl_ms;
+    fill->read_fd = fill->write_fd = -1;
+    if ( worker_id < 0 && ! inline_dispatch ) { // the response comes back by pipe
+        int p[2];
+        if ( pipe( p ) != 0 ) {
+            perror("pipe() error, response not cached");
+            delete fill;
+            return false;
+        }
+        set_nonblock( p[0] );
+        fill->read_fd = p[0];
+        fill->write_fd = p[1];
+        rcache->fill_fds[ p[0] ] = fill;
+#ifdef USE_IO_URING
+        if ( uring )
+            uring_prep_poll( uring->sqe(), p[0], POLLIN, URING_DATA( URING_POLL, 0, p[0] ) );
+#endif
+    }
+    rcache->fills[ key ] = fill;
+    handOff( c, fill );
+    return true;
+}
+
+/* \brief respond with a cached response, from the event loop: sent as the
+   socket takes it (most of the time, one send, from the cache's copy) */
+void SimpleHttp::sendCached( http_conn *c, const std::string &response, const std::string &key )
+{
+    std::string ip_addr_str = c->ip_addr_str;
+    http_host = c->host;
+    struct tm * timeinfo = localtime ( &c->accept_time );
+    if ( c->trace ) {
+        c->trace->route = key.substr( 0, key.find( '?' ) );
+        c->trace->cached = true;
+    }
+
+    LOG_IT;
+    if (log==1) printf(" %s [cached]", key.c_str() );
+    writeResponse( c, response );
+}
+
+/* \brief read a fill pipe; at EOF, complete the fill; returns requests served */
+int SimpleHttp::readFill( int fd )
+{
+    cache_fill *fill = rcache->fill_fds[ fd ];
+    char buf[ READ_BUF_SIZE * 16 ];
+    for (;;) {
+        int n = READ( fd, buf, sizeof(buf) );
+        if ( n > 0 ) {
+            fill->data.append( buf, n );
+            continue;
+        }
+        if ( n < 0 && errno == EINTR )
+            continue;
+        if ( n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+            return 0;
+        break; // EOF (or error)
+    }
+    uint64_t len = 0;
+    bool ok = fill->data.size() >= sizeof(len);
+    if ( ok ) {
+        memcpy( &len, fill->data.data(), sizeof(len) );
+        ok = ( fill->data.size() == sizeof(len) + len );
+    }
+    int served = (int) fill->waiters.size();
+    completeFill( fill, ok ? fill->data.substr( sizeof(len) ) : std::string(), ok );
+    return served;
+}
+
+/* \brief a fill's response is in (ok) or its responder died: cache it,
+   answer the clients waiting for it, and drop the fill */
+void SimpleHttp::completeFill( cache_fill *fill, const std::string &response, bool ok )
+{
+    ok = ok && ! response.empty();
+    // (a fill given up on isn't cached either: a newer one may have been)
+    std::map< std::string, cache_fill * >::iterator f = rcache->fills.find( fill->key );
+    bool current = f != rcache->fills.end() && f->second == fill;
+    if ( current )
+        rcache->fills.erase( f );
+
+    // only successes are cached (but waiters get whatever their twin got)
+    if ( ok && current && ( response.compare( 0, 13, "HTTP/1.0 200 " ) == 0
+                || response.compare( 0, 13, "HTTP/1.1 200 " ) == 0 ) )
+        cacheStore( fill->key, response, fill->ttl_ms );
+    else if (log>1) printf("response cache: %s not cached\n", fill->key.c_str() );
+
+    if ( fill->read_fd >= 0 ) {
+        rcache->fill_fds.erase( fill->read_fd );
+        CLOSE( fill->read_fd );
+    }
+    if ( fill->write_fd >= 0 )
+        CLOSE( fill->write_fd );
+    for (size_t i=0; i<fill->waiters.size(); i++) {
+        http_conn *c = fill->waiters[i];
+        timers->cancel( &c->timer );
+        c->waiting_on = NULL;
+        if ( ok )
+            sendCached( c, response, fill->key );
+        else
+            handOff( c, NULL );
+    }
+    delete fill;
+}
+
+/* \brief add a response, evicting least recently used ones to fit cache_max_bytes */
+void SimpleHttp::cacheStore( const std::string &key, const std::string &response,
+        unsigned int ttl_ms )
+{
+    size_t size = key.size() + response.size();
+    if ( size > cache_max_bytes )
+        return;
+    cacheErase( key );
+    while ( rcache->bytes + size > cache_max_bytes && ! rcache->lru.empty() )
+        cacheErase( rcache->lru.back() );
+    rcache->lru.push_front( key );
+    cache_entry &e = rcache->entries[ key ];
+    e.response = response;
+    e.expires_ms = TimerWheel::now_ms() + ttl_ms;
+    e.lru = rcache->lru.begin();
+    rcache->bytes += size;
+}
+
+void SimpleHttp::cacheErase( const std::string &key )
+{
+    std::map< std::string, cache_entry >::iterator e = rcache->entries.find( key );
+    if ( e == rcache->entries.end() )
+        return;
+    rcache->bytes -= e->first.size() + e->second.response.size();
+    rcache->lru.erase( e->second.lru );
+    rcache->entries.erase( e );
+}
+
+/* \brief drop cached responses and fills in progress (and their waiters) */
+void SimpleHttp::cacheClear()
+{
+    if ( rcache == NULL )
+        return;
+    std::set< cache_fill * > fills; // (those given up on are only in fill_fds)
+    for ( std::map< std::string, cache_fill * >::iterator i = rcache->fills.begin();
+            i != rcache->fills.end(); ++i )
+        fills.insert( i->second );
+    for ( std::map< int, cache_fill * >::iterator i = rcache->fill_fds.begin();
+            i != rcache->fill_fds.end(); ++i )
+        fills.insert( i->second );
+    for ( std::set< cache_fill * >::iterator i = fills.begin(); i != fills.end(); ++i ) {
+        cache_fill *fill = *i;
+        for (size_t j=0; j<fill->waiters.size(); j++)
+            closeConnection( fill->waiters[j] );
+        if ( fill->read_fd >= 0 )
+            CLOSE( fill->read_fd );
+        if ( fill->write_fd >= 0 )
+            CLOSE( fill->write_fd );
+        delete fill;
+    }
+    rcache->fills.clear();
+    rcache->fill_fds.clear();
+    rcache->entries.clear();
+    rcache->lru.clear();
+    rcache->bytes = 0;
+}
+#endif // MS_WINDOWS
+
+
+/////////////////////////////////////////
+// websockets (RFC 6455): upgraded connections stay in the event loop
+
+/* \brief accept websockets at route; fn gets their events.  Messages
+   are sent with ws_send(), ws_broadcast(); the connections are the
+   event loop's (the main process, or each worker), not a responder's */
+void SimpleHttp::websocket( std::string route, SIMPLEHTTP_WS_CALLBACK fn )
+{
+#ifdef MS_WINDOWS
+    printf("warning: no websockets on windows, not serving %s\n", route.c_str());
+#else
+    ws_funct[ route ] = fn;
+    if ( ws == NULL )
+        ws = new ws_state;
+    if (log>1) printf("server websocket: %s\n",route.c_str() );
+#endif
+}
+
+#ifndef MS_WINDOWS
+//!> value of header field name (lower case, with the ':'), trimmed; "" if none
+static std::string header_field( const std::string &req, const char *name )
+{
+    size_t hdr_size = header_size( req );
+    size_t n = strlen( name );
+    for (size_t i=0; i+n+1<hdr_size; i++) {
+        if ( req[i] == '\n' && strncasecmp( req.c_str()+i+1, name, n ) == 0 ) {
+            size_t start = req.find_first_not_of( " \t", i+1+n );
+            size_t end = req.find_first_of( "\r\n", i+1+n );
+            if ( start == std::string::npos || start >= end )
+                return std::string();
+            return req.substr( start, req.find_last_not_of( " \t", end-1 ) + 1 - start );
+        }
+    }
+    return std::string();
+}
+
+//!> does (comma separated) list have token, ignoring case?
+static bool has_token( const std::string &list, const char *token )
+{
+    size_t n = strlen( token );
+    for (size_t i=0; i+n<=list.size(); i++)
+        if ( strncasecmp( list.c_str()+i, token, n ) == 0 )
+            return true;
+    return false;
+}
+
+/* \brief set up the pipe that wakes the event loop for ws_send(), etc */
+void SimpleHttp::wsStart()
+{
+    if ( ws->wake[0] >= 0 )
+        return;
+    if ( pipe( ws->wake ) != 0 ) {
+        perror("pipe() error, no websocket sends");
+        ws->wake[0] = ws->wake[1] = -1;
+        return;
+    }
+    set_nonblock( ws->wake[0] );
+    set_nonblock( ws->wake[1] );
+}
+
+
+/* \brief if c's request is for a websocket route, take it over: the
+   upgrade handshake (or an error reply); false if it isn't */
+bool SimpleHttp::wsUpgrade( http_conn *c )
+{
+    const std::string &req = c->req;
+    if ( req.compare( 0, 4, "GET " ) != 0 )
+        return false;
+    size_t end = req.find_first_of( " \t\r\n", 4 );
+    if ( end == std::string::npos )
+        return false;
+    std::string route = req.substr( 4, end - 4 );
+    route.resize( std::min( route.find( '?' ), route.size() ) );
+    std::map< std::string, SIMPLEHTTP_WS_CALLBACK >::iterator f = ws_funct.find( route );
+    if ( f == ws_funct.end() )
+        return false;
+    if ( c->ssl ) { // (the loop's websocket i/o is plain text)
+        closeConnection( c, "websocket: not over https",
+                "HTTP/1.1 501 Not Implemented\r\n\r\n" );
+        return true;
+    }
+
+    std::string key = header_field( req, "sec-websocket-key:" );
+    if ( header_field( req, "sec-websocket-version:" ) != "13" ) {
+        closeConnection( c, "websocket: not version 13",
+                "HTTP/1.1 426 Upgrade Required\r\nSec-WebSocket-Version: 13\r\n\r\n" );
+        return true;
+    }
+    if ( key.empty() || req.compare( end, 8, " HTTP/1." ) != 0
+            || ! has_token( header_field( req, "upgrade:" ), "websocket" )
+            || ! has_token( header_field( req, "connection:" ), "upgrade" ) ) {
+        closeConnection( c, "websocket: bad upgrade request",
+                "HTTP/1.1 400 Bad Request\r\n\r\n" );
+        return true;
+    }
+
+    set_nonblock( c->fd ); // (io_uring accepts leave it blocking)
+    ws_conn *w = new ws_conn;
+    w->fd = c->fd;
+    w->gen = c->gen;
+    w->id = ++ws->last_id;
+    w->route = route;
+    w->msg_opcode = 0;
+    w->out_sent = 0;
+    w->queued = 0;
+    w->closing = false;
+    w->closed = false;
+    w->write_armed = false;
+    ws->conns[ w->fd ] = w;
+    ws->ids[ w->id ] = w;
+
+    std::string ip_addr_str = c->ip_addr_str;
+    http_host = c->host;
+    struct tm * timeinfo = localtime ( &c->accept_time );
+    LOG_IT;
+    if (log) printf(" %s [websocket %llu]\n", route.c_str(), (unsigned long long)w->id );
+    if ( c->trace ) {
+        c->trace->route = route;
+        trace_mark( c->trace, c->fd, TRACE_ROUTED );
+    }
+    trace_mark( c->trace, c->fd, TRACE_DONE );
+    traceDone( c->trace );
+    std::string upgrade_req;
+    upgrade_req.swap( c->req );
+    delete c;
+
+    websocket_id id = w->id;
+    if ( wsQueue( w, ws_frame_ptr( new std::string( "HTTP/1.1 101 Switching Protocols\r\n"
+                    "Upgrade: websocket\r\nConnection: Upgrade\r\n"
+                    "Sec-WebSocket-Accept: " + ws_accept_key( key ) + "\r\n\r\n" ) ) )
+            && wsFlush( w ) )
+        (f->second)( this, id, WS_OPEN, route, upgrade_req, false, context );
+    return true;
+}
+
+
+/* \brief read what's available of a websocket (poll backend) */
+int SimpleHttp::wsRead( ws_conn *w, int budget )
+{
+    char buf[ READ_BUF_SIZE * 16 ];
+    for ( ; budget > 0; budget-- ) {
+        int n = recv( w->fd, buf, sizeof(buf), 0 );
+        if ( n > 0 ) {
+            w->in.append( buf, n );
+            continue;
+        }
+        if ( n == 0 ) {
+            wsClose( w, NULL );
+            return 0;
+        }
+        if ( errno == EAGAIN || errno == EWOULDBLOCK )
+            break;
+        if ( errno == EINTR )
+            continue;
+        wsClose( w, "recv() error" );
+        return 0;
+    }
+    return wsFrames( w ) ? 1 : 0;
+}
+
+
+/* \brief handle the whole frames in w->in: messages to the callback,
+   pings answered, close answered; false if w's been closed */
+bool SimpleHttp::wsFrames( ws_conn *w )
+{
+    size_t pos = 0;
+    while ( ! w->closing ) {
+        ws_header h;
+        long n = ws_parse_header( w->in.data() + pos, w->in.size() - pos, h );
+        if ( n == 0 )
+            break;
+        if ( n < 0 || ! h.masked ) { // (clients must mask)
+            wsClosing( w, 1002, "protocol error" );
+            break;
+        }
+        if ( h.payload_size > ws_max_message
+                || w->msg.size() + h.payload_size > ws_max_message ) {
+            wsClosing( w, 1009, "message too big" );
+            break;
+        }
+        if ( w->in.size() - pos < n + h.payload_size )
+            break; // (rest of the payload to come)
+
+        char *payload = &w->in[ pos + n ];
+        size_t size = (size_t) h.payload_size;
+        ws_unmask( payload, size, h.mask );
+        pos += n + size;
+
+        if ( h.opcode == WS_OP_PING ) {
+            if ( ! wsQueue( w, ws_frame_ptr( new std::string(
+                            ws_frame( WS_OP_PONG, std::string( payload, size ) ) ) ) ) )
+                return false; // (dropped)
+            continue;
+        }
+        if ( h.opcode == WS_OP_PONG )
+            continue;
+        if ( h.opcode == WS_OP_CLOSE ) { // answer with its status code, then close
+            uint16_t code = size >= 2 ? (uint16_t)( ( (unsigned char)payload[0] << 8 )
+                    | (unsigned char)payload[1] ) : 1000;
+            wsClosing( w, code, std::string() );
+            break;
+        }
+        if ( h.opcode == WS_OP_CONTINUATION ? w->msg_opcode == 0 : w->msg_opcode != 0 ) {
+            wsClosing( w, 1002, "unexpected continuation" );
+            break;
+        }
+        if ( h.opcode != WS_OP_CONTINUATION && h.opcode != WS_OP_TEXT
+                && h.opcode != WS_OP_BINARY ) {
+            wsClosing( w, 1002, "unknown opcode" );
+            break;
+        }
+        if ( h.opcode != WS_OP_CONTINUATION )
+            w->msg_opcode = h.opcode;
+        w->msg.append( payload, size );
+        if ( ! h.fin )
+            continue;
+
+        // a whole message (the callback can't close w: ws_close() posts)
+        std::string msg;
+        msg.swap( w->msg );
+        bool binary = ( w->msg_opcode == WS_OP_BINARY );
+        w->msg_opcode = 0;
+        if (log>2) printf("websocket %llu: %d byte message\n",
+                (unsigned long long)w->id, (int)msg.size() );
+        (ws_funct[ w->route ])( this, w->id, WS_MESSAGE, w->route, msg, binary, context );
+    }
+    if ( w->closed )
+        return false;
+    w->in.erase( 0, w->closing ? w->in.size() : pos );
+    return w->out.empty() ? true : wsFlush( w );
+}
+
+/* \brief queue a close frame; w's closed once it's sent */
+void SimpleHttp::wsClosing( ws_conn *w, int code, const std::string &reason )
+{
+    if ( w->closing )
+        return;
+    if ( reason.size() && log ) printf("websocket %llu - %s\n",
+            (unsigned long long)w->id, reason.c_str() );
+    std::string payload;
+    payload += (char)( code >> 8 );
+    payload += (char)( code & 0xff );
+    payload += reason;
+    if ( wsQueue( w, ws_frame_ptr( new std::string( ws_frame( WS_OP_CLOSE, payload ) ) ) ) )
+        w->closing = true;
+}
+
+
+/* \brief add a frame to w's queue (sent by wsFlush); false if w's
+   closed (that dropped it, over ws_max_backlog, say) */
+bool SimpleHttp::wsQueue( ws_conn *w, const ws_frame_ptr &frame )
+{
+    if ( w->closed )
+        return false;
+    if ( w->closing )
+        return true; // (nothing after the close frame)
+    if ( ws_max_backlog && w->queued + frame->size() > ws_max_backlog ) {
+        wsClose( w, "send backlog full (slow client)" );
+        return false;
+    }
+    w->out.push_back( frame );
+    w->queued += frame->size();
+    return true;
+}
+
+/* \brief send w's queue, as far as the socket takes it; false if w's
+   been closed (error, or done closing) */
+bool SimpleHttp::wsFlush( ws_conn *w )
+{
+    if ( w->closed )
+        return false;
+    while ( ! w->out.empty() ) {
+        struct iovec iov[ WS_IOVECS ];
+        int n = 0;
+        for ( std::deque< ws_frame_ptr >::iterator i = w->out.begin();
+                i != w->out.end() && n < WS_IOVECS; ++i, n++ ) {
+            size_t skip = ( n == 0 ) ? w->out_sent : 0;
+            iov[n].iov_base = (void *)( (*i)->data() + skip );
+            iov[n].iov_len = (*i)->size() - skip;
+        }
+        struct msghdr mh;
+        memset( &mh, 0, sizeof(mh) );
+        mh.msg_iov = iov;
+        mh.msg_iovlen = n;
+        ssize_t sent = sendmsg( w->fd, &mh, MSG_NOSIGNAL );
+        if ( sent < 0 ) {
+            if ( errno == EINTR )
+                continue;
+            if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+#ifdef USE_IO_URING
+                if ( uring && ! w->write_armed ) { // (poll backend: see getFds)
+                    uring_prep_poll( uring->sqe(), w->fd, POLLOUT,
+                            URING_DATA( URING_POLL, w->gen, w->fd ) );
+                    w->write_armed = true;
+                }
+#endif
+                return true;
+            }
+            wsClose( w, "send() error" );
+            return false;
+        }
+        w->queued -= sent;
+        while ( sent > 0 ) {
+            size_t left = w->out.front()->size() - w->out_sent;
+            if ( (size_t)sent < left ) {
+                w->out_sent += sent;
+                break;
+            }
+            sent -= left;
+            w->out.pop_front();
+            w->out_sent = 0;
+        }
+    }
+    if ( w->closing ) {
+        wsClose( w, NULL );
+        return false;
+    }
+    return true;
+}
+
+
+/* \brief close w now, and tell the callback; w's freed later (wsReap),
+   the caller (and its callers) may still be looking at it */
+void SimpleHttp::wsClose( ws_conn *w, const char *why )
+{
+    if ( w->closed )
+        return;
+    w->closed = true;
+    if (log && why) printf("websocket %llu - %s\n", (unsigned long long)w->id, why );
+    if (log>1) printf("websocket %llu closed\n", (unsigned long long)w->id );
+    ws->conns.erase( w->fd );
+    ws->ids.erase( w->id );
+    shutdown( w->fd, SHUT_RDWR ); // (ends an io_uring recv too)
+    CLOSE( w->fd );
+    ws->closed.push_back( w );
+    SIMPLEHTTP_WS_CALLBACK fn = ws_funct[ w->route ];
+    (fn)( this, w->id, WS_CLOSE, w->route, std::string(), false, context );
+}
+
+/* \brief free the websockets closed since last time (from the top of the
+   event loop, when nothing's holding on to them) */
+void SimpleHttp::wsReap()
+{
+    for (size_t i=0; i<ws->closed.size(); i++)
+        delete ws->closed[i];
+    ws->closed.clear();
+}
+
+
+/* \brief hand p to the event loop, and wake it (if not already) */
+bool SimpleHttp::wsPost( const ws_post &p )
+{
+    if ( ws == NULL || ws->wake[1] < 0 )
+        return false;
+    bool wake;
+    {
+        std::lock_guard< std::mutex > hold( ws->lock );
+        ws->posted.push_back( p );
+        wake = ! ws->woken;
+        ws->woken = true;
+    }
+    if ( wake ) {
+        char b = 1;
+        if ( write( ws->wake[1], &b, 1 ) < 0 && errno != EAGAIN )
+            perror("websocket wake pipe");
+    }
+    return true;
+}
+
+/* \brief (event loop) queue what's been posted, then send it */
+int SimpleHttp::wsWake()
+{
+    char buf[64];
+    while ( read( ws->wake[0], buf, sizeof(buf) ) > 0 )
+        ;
+    std::vector< ws_post > posted;
+    {
+        std::lock_guard< std::mutex > hold( ws->lock );
+        posted.swap( ws->posted );
+        ws->woken = false;
+    }
+
+    std::set< websocket_id > to_flush;
+    std::vector< ws_conn * > to;
+    for (size_t i=0; i<posted.size(); i++) {
+        to.clear();
+        if ( posted[i].id ) {
+            std::map< websocket_id, ws_conn * >::iterator w = ws->ids.find( posted[i].id );
+            if ( w != ws->ids.end() )
+                to.push_back( w->second );
+        }
+        else {
+            for ( std::map< SOCKET_TYPE, ws_conn * >::iterator w = ws->conns.begin();
+                    w != ws->conns.end(); ++w )
+                if ( w->second->route == posted[i].route )
+                    to.push_back( w->second );
+        }
+        for (size_t j=0; j<to.size(); j++) {
+            websocket_id id = to[j]->id;
+            if ( ! wsQueue( to[j], posted[i].frame ) )
+                continue; // (dropped)
+            if ( posted[i].close )
+                to[j]->closing = true;
+            to_flush.insert( id );
+        }
+    }
+    for ( std::set< websocket_id >::iterator i = to_flush.begin(); i != to_flush.end(); ++i ) {
+        std::map< websocket_id, ws_conn * >::iterator w = ws->ids.find( *i );
+        if ( w != ws->ids.end() )
+            wsFlush( w->second );
+    }
+    return (int) posted.size();
+}
+#endif // MS_WINDOWS
+
+
+bool SimpleHttp::ws_send( websocket_id id, const std::string &msg, bool binary )
+{
+#ifdef MS_WINDOWS
+    return false;
+#else
+    ws_post p;
+    p.id = id;
+    p.frame = ws_frame_ptr( new std::string(
+                ws_frame( binary ? WS_OP_BINARY : WS_OP_TEXT, msg ) ) );
+    p.close = false;
+    return wsPost( p );
+#endif
+}
+
+bool SimpleHttp::ws_broadcast( std::string route, const std::string &msg, bool binary )
+{
+#ifdef MS_WINDOWS
+    return false;
+#else
+    ws_post p;
+    p.id = 0;
+    p.route = route;
+    p.frame = ws_frame_ptr( new std::string(
+                ws_frame( binary ? WS_OP_BINARY : WS_OP_TEXT, msg ) ) );
+    p.close = false;
+    return wsPost( p );
+#endif
+}
+
+bool SimpleHttp::ws_close( websocket_id id )
+{
+#ifdef MS_WINDOWS
+    return false;
+#else
+    std::string payload( "\x03\xe8", 2 ); // 1000, normal closure
+    ws_post p;
+    p.id = id;
+    p.frame = ws_frame_ptr( new std::string( ws_frame( WS_OP_CLOSE, payload ) ) );
+    p.close = true;
+    return wsPost( p );
+#endif
+}
+
+
 /* did server halt? */
 bool SimpleHttp::is_stopped()
 {
@@ -591,10 +3180,16 @@ void SimpleHttp::stop()
 /* \brief poll for http server events, handle, repeat ... */
 void SimpleHttp::eventLoop()
 {
-    for (;;) {
-        handleEvents();
-        if (is_stopped()) break;
-        usleep( 1000 * 250 ); 
+    handleEvents(); // (starts the server, if need be)
+    while ( status == STARTED || status == SERVER_ERROR ) {
+#ifndef MS_WINDOWS
+        if ( ! worker_pids.empty() ) {
+            usleep( 1000 * nextTimeout() );
+            processTimers();
+            continue;
+        }
+#endif
+        pollEvents( EVENT_LOOP_WAIT_MS );
     }
 }
 
@@ -602,15 +3197,47 @@ void SimpleHttp::eventLoop()
 void SimpleHttp::closeServer()
 {
     stop();
-    if ( ( listen_socket != SOCKET_ERROR )
-            && (listen_socket != INVALID_SOCKET ) ) {
-#ifdef MS_WINDOWS
-        closesocket( listen_socket );
-#else
-        shutdown( listen_socket, SHUT_RDWR );
+#ifndef MS_WINDOWS
+    stopWorkers();
 #endif
-        listen_socket = INVALID_SOCKET;
+#ifdef USE_IO_URING
+    // submit the closes etc already queued, then close what's left
+    // directly (not by the ring, which is going): then delete the ring
+    // (which cancels what's still in flight, recvs, polls)
+    IoUring *ring = uring;
+    uring = NULL;
+    if ( ring )
+        ring->submit();
+#endif
+    while ( ! conns.empty() )
+        closeConnection( conns.begin()->second );
+#ifndef MS_WINDOWS
+    cacheClear();
+    if ( ws ) {
+        while ( ! ws->conns.empty() )
+            wsClose( ws->conns.begin()->second, NULL );
+        wsReap();
+        for (int i=0; i<2; i++) {
+            if ( ws->wake[i] >= 0 )
+                CLOSE( ws->wake[i] );
+            ws->wake[i] = -1;
+        }
+        ws->wake_armed = false;
+    }
+    if ( tpipe ) {
+        CLOSE( tpipe->fd[0] );
+        CLOSE( tpipe->fd[1] );
+        delete tpipe;
+        tpipe = NULL;
     }
+#endif
+#ifdef USE_IO_URING
+    delete ring;
+#endif
+    closeListeners();
+    for (size_t i=listeners.size(); i-- > 0; )
+        if ( listeners[i].implicit )
+            listeners.erase( listeners.begin() + i );
     status = CLOSED;
 }
 
@@ -26,7 +26,7 @@
 #  endif
 //# define SOCKET_TYPE SOCKET
 # define SOCKET_TYPE unsigned int
-# define SOCKET_SEND(s,b,l)    send(SOCKET(s),b,l,0)     
+# define SOCKET_WRITE(s,b,l)   send(SOCKET(s),b,l,0)
 # define OPEN _open
 # define READ _read
 # define CLOSE _close
@@ -38,19 +38,29 @@
 # define SOCKET_TYPE int
 # define SOCKET_ERROR -1
 # define INVALID_SOCKET -1
-# define SOCKET_SEND(s,b,l)    write(s,b,l)
+# define SOCKET_WRITE(s,b,l)   write(s,b,l)
 # define OPEN open
 # define READ read
 # define CLOSE close
 #endif
 
+// a callback's sends go by the server (so on https they're encrypted, for
+// cache() routes they're captured, ...); SOCKET_WRITE is the bare socket's
+#define SOCKET_SEND(s,b,l)    SimpleHttp::socket_send(s,b,l)
+
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <string>
 #include <map>
+#include <vector>
+#include <memory>
+#include <time.h>
 
 enum page_type { CONTENT, FILENAME };
 enum status_type { INIT, STARTED, STOP, SERVER_ERROR, CLOSED };
+enum io_backend_type { POLL_BACKEND, IO_URING_BACKEND };
+enum event_type { EVENT_READ = 0x1, EVENT_WRITE = 0x4 }; //!< (== POLLIN, POLLOUT on linux)
 
 //!> static page info
 typedef struct {
@@ -61,7 +71,62 @@ typedef struct {
 } page_info;
 
 
+//!> request lifecycle phases, in order (see http_trace)
+enum trace_phase {
+    TRACE_ACCEPT,       //!< connection ready to accept() (io_uring: accepted)
+    TRACE_RESOLVED,     //!< client's host looked up (lookup_hosts)
+    TRACE_FIRST_BYTE,   //!< first bytes of the request read
+    TRACE_READ,         //!< whole request read, dispatching
+    TRACE_START,        //!< responder (process/thread) running
+    TRACE_ROUTED,       //!< route looked up
+    TRACE_HANDLED,      //!< callback returned, or page/file sent
+    TRACE_DONE,         //!< response sent, connection closed
+    TRACE_PHASES
+};
+
+//!> one request's trace (see SimpleHttp::trace_sink)
+typedef struct {
+    uint64_t id;            //!< request number (per process that accepted it)
+    SOCKET_TYPE fd;
+    std::string route;      //!< empty if dropped before dispatch (timeout, etc)
+    bool cached;            //!< served from the response cache
+    uint64_t t[ TRACE_PHASES ]; //!< monotonic ns at each phase; 0 = not reached
+} http_trace;
+
+
+//!> a socket to watch for events (see SimpleHttp::getFds)
+typedef struct {
+    SOCKET_TYPE fd;
+    int events;     //!< EVENT_READ | EVENT_WRITE
+} watch_fd;
+
+//!> a socket the server listens on (see SimpleHttp::addListener)
+typedef struct {
+    std::string host;   //!< address to bind; "" = any (ipv6 dual-stack, else ipv4)
+    int port;
+    std::string path;   //!< unix domain socket path (host, port unused), or ""
+    int mode;           //!< the unix socket's permissions
+    bool https;         //!< tls, see SimpleHttp::tls()
+    SOCKET_TYPE fd;     //!< INVALID_SOCKET if not open
+    bool accepting;     //!< io_uring backend: multishot accept armed
+    int owner;          //!< pid that bound the unix socket (and so removes it)
+    bool implicit;      //!< start()'s, on port (no others added); dropped by closeServer()
+} listen_info;
+
+
 class EXPORT_MARKER SimpleHttp;
+class TimerWheel;
+class IoUring;
+struct http_conn;
+struct cache_fill;
+struct response_cache;
+struct ws_conn;
+struct ws_post;
+struct ws_state;
+struct trace_pipe;
+struct sockaddr;
+struct ssl_st;      // (openssl's SSL, SSL_CTX)
+struct ssl_ctx_st;
 
 
 //!> call back type
@@ -73,18 +138,112 @@ typedef void ( * SIMPLEHTTP_CALLBACK ) (
   void *context //!< a pointer ...
   );
 
+//!> websocket events (see SIMPLEHTTP_WS_CALLBACK)
+enum ws_event { WS_OPEN, WS_MESSAGE, WS_CLOSE };
+typedef uint64_t websocket_id;  //!< a websocket connection (per process, never reused)
+
+//!> websocket call back type; called on the event loop's thread
+typedef void ( * SIMPLEHTTP_WS_CALLBACK ) (
+  SimpleHttp *server,
+  websocket_id ws,
+  ws_event event,
+  std::string route,
+  const std::string &data,  //!< WS_MESSAGE: the message; WS_OPEN: the upgrade request
+  bool binary,              //!< WS_MESSAGE: binary (else text) message
+  void *context
+  );
+
+//!> trace sink type; called where the request finished: the event loop, or
+//!> the responding thread (concurrently) in thread mode.  Forked children's
+//!> traces come back to the event loop's process for it; each worker
+//!> process has its own
+typedef void ( * SIMPLEHTTP_TRACE_SINK ) (
+  SimpleHttp *server,
+  const http_trace *trace,
+  void *context //!< server->context
+  );
+
 
 //!> simple forking or threaded HTTP server
 class EXPORT_MARKER SimpleHttp {
     private:
         std::map< std::string, page_info > page_map;
         std::map< std::string, SIMPLEHTTP_CALLBACK > page_funct; //!< pg name => callback
+        std::map< SOCKET_TYPE, http_conn * > conns; //!< connections reading a request (or writing
+                                                    //!< an inline response)
+        TimerWheel *timers;     //!< idle/header/body deadlines of conns
+        IoUring *uring;         //!< io_uring backend ring, if in use
         status_type status;
-        static void set_nonblock(SOCKET_TYPE socket);
+        static void set_nonblock(SOCKET_TYPE socket, bool nonblock=true);
 #ifdef MS_WINDOWS
         static void usleep (long usec);
 #endif
         void init();
+        std::vector< listen_info > listeners;   //!< (listen_socket is the first's fd)
+        SOCKET_TYPE openListenSocket( listen_info &l ); //!< bound, listening tcp socket
+        SOCKET_TYPE openUnixSocket( listen_info &l );   //!< bound, listening unix socket
+        bool openListeners( bool tcp_only=false );
+        void closeListeners( bool tcp_only=false );
+        ssl_ctx_st *tls_ctx;                    //!< https listeners' certificate etc
+        void startBackend();                    //!< event loop backend set up
+        std::vector< int > worker_pids;         //!< (pre-forked) worker processes
+        std::vector< time_t > worker_started;
+        int worker_id;                          //!< this worker's index, or -1
+        void startWorker( int i );              //!< fork worker i
+        int superviseWorkers();                 //!< restart dead workers
+        void stopWorkers();
+        int pollEvents( int timeout_ms );       //!< wait for, then handle, socket events
+        int pollUring( int timeout_ms );        //!< pollEvents(), io_uring backend
+        void armUring();
+        int processUring( int budget );
+        int acceptConnections( listen_info &l, int budget ); //!< accept pending connections
+        http_conn *addConnection( SOCKET_TYPE fd, const struct sockaddr *addr, bool https,
+                uint64_t accept_ns );
+        bool readConnection( http_conn *c, int budget=64 ); //!< read request; true if dispatched
+        bool parseRequest( http_conn *c );      //!< dispatch once read; true if dispatched
+        int expireTimers();                     //!< time out slow connections
+        void closeConnection( http_conn *c, const char *why=NULL, const char *reply=NULL );
+        void dispatch( http_conn *c );          //!< serve a read request (cache, or handOff)
+        void handOff( http_conn *c, cache_fill *fill ); //!< fork/thread respond()
+        void responder( SOCKET_TYPE fd, std::string req, http_trace *trace, ssl_st *ssl,
+                int fill_fd );                          //!< respond() in a fork/thread
+        void writeResponse( http_conn *c, const std::string &response ); //!< send, from the loop
+        bool writeConnection( http_conn *c, const char *data=NULL, size_t len=0 );
+                                                //!< send what's queued; false if c closed
+        void serve( SOCKET_TYPE fd, std::string req );  //!< route and send a response
+        void endResponse( SOCKET_TYPE fd );
+        uint64_t trace_seq;                     //!< requests accepted, for trace_sample
+        void traceDone( http_trace *trace );    //!< to trace_sink
+        trace_pipe *tpipe;                      //!< (forking) children's traces, back to the loop
+        int readTraces();
+
+        std::map< std::string, unsigned int > cache_ttl; //!< cached route => ttl (ms)
+        response_cache *rcache;
+        bool cacheKey( const std::string &req, std::string &key, unsigned int &ttl_ms );
+        bool cacheDispatch( http_conn *c );
+        void sendCached( http_conn *c, const std::string &response, const std::string &key );
+        int readFill( int fd );
+        void completeFill( cache_fill *fill, const std::string &response, bool ok );
+        void cacheStore( const std::string &key, const std::string &response, unsigned int ttl_ms );
+        void cacheErase( const std::string &key );
+        void cacheClear();
+
+        std::map< std::string, SIMPLEHTTP_WS_CALLBACK > ws_funct; //!< websocket routes
+        ws_state *ws;
+        void wsStart();                         //!< (per process) wake pipe
+        bool wsUpgrade( http_conn *c );         //!< handshake, if c's route is a websocket's
+        int wsRead( ws_conn *w, int budget );
+        bool wsFrames( ws_conn *w );            //!< handle w's frames read; false if w closed
+        void wsClosing( ws_conn *w, int code, const std::string &reason );
+        bool wsQueue( ws_conn *w, const std::shared_ptr< const std::string > &frame );
+        bool wsFlush( ws_conn *w );             //!< send what's queued; false if w closed
+        void wsClose( ws_conn *w, const char *why );
+        void wsReap();                          //!< free closed websockets
+        bool wsPost( const ws_post &p );        //!< (any thread) hand to the event loop
+        int wsWake();                           //!< take what's been posted
+
+        SimpleHttp( const SimpleHttp & );       // (owns its timers etc: not copyable)
+        SimpleHttp & operator=( const SimpleHttp & );
     public:
         SimpleHttp();               //!< create server (at port 80)
         SimpleHttp( int port );     //!< create server at port
@@ -92,16 +251,42 @@ class EXPORT_MARKER SimpleHttp {
 
         bool start();               //!< start the server
 
+        // listeners, added before start(); without any, start() listens on
+        // port (any address; the port at this start(), not a past one's).
+        // Connections from all of them are served alike.
+        bool addListener( std::string host, int port, bool https=false );
+                                    //!< listen on host ("" = any, "::1", "[::]", "127.0.0.1", ...) : port
+        bool addUnixListener( std::string path, int mode=0660 );
+                                    //!< listen on a unix domain socket (not windows)
+        bool tls( std::string cert_file, std::string key_file );
+                                    //!< https: certificate (chain) and key, PEM (-DUSE_OPENSSL);
+                                    //!< the listener start() adds is then https
+
         void file( std::string route, std::string filename, std::string header="" ); //!< serve a file
         void page( std::string route, std::string page, std::string header="" );    //!< serve a page
         void page( std::string route, SIMPLEHTTP_CALLBACK);
                                     //!< serve with callback
+        void cache( std::string route, unsigned int ttl_ms );
+                                    //!< cache a callback route's responses for ttl_ms
+        void websocket( std::string route, SIMPLEHTTP_WS_CALLBACK );
+                                    //!< accept websockets at route (not windows)
 
         bool handleEvents();    //!< process (fork) pending server events, non-blocking
         bool is_stopped();      //!< is the server in the STOP status ?
         void stop();            //!< request that the server stop/halt
         void eventLoop();       //!< handle events until stopped
 
+        // embedding: drive the server from the host program's own event loop
+        // (after start()) - watch getFds() (again after each processReady(),
+        // the set changes), processReady() the ones that are ready, and call
+        // processTimers() once nextTimeout() is up.  None of these block;
+        // set inline_dispatch to run the responses on the host's thread.
+        int getFds( std::vector< watch_fd > &fds );     //!< sockets to watch, and for what
+        int processReady( SOCKET_TYPE fd, int events, int budget=64 );
+                                //!< handle fd's events, at most budget accepts/reads
+        long nextTimeout();     //!< ms until processTimers() has work; -1 = none
+        int processTimers();    //!< expire timeouts
+
         void closeServer();     //!< shut down serrver, close port etc
 
         int http_send_ok(SOCKET_TYPE fd, std::string header="" );
@@ -110,17 +295,64 @@ class EXPORT_MARKER SimpleHttp {
                     //!< send s to client
         int http_send(SOCKET_TYPE client_socket, char *buf, size_t buf_size );
                     //!< send s to client
+        static int socket_send( SOCKET_TYPE fd, const char *buf, size_t len );
+                    //!< send buf to client (SOCKET_SEND)
 
-        void respond( SOCKET_TYPE fd );
+        // websockets; these may be called from any thread (the event loop
+        // sends), and return false if there's no event loop running them
+        bool ws_send( websocket_id ws, const std::string &msg, bool binary=false );
+                    //!< send a message
+        bool ws_broadcast( std::string route, const std::string &msg, bool binary=false );
+                    //!< send a message to all of route's websockets (framed once)
+        bool ws_close( websocket_id ws );
+                    //!< close (after what's been sent)
+
+        void respond( SOCKET_TYPE fd );     //!< read a request from fd, then respond
+        void respond( SOCKET_TYPE fd, std::string req ); //!< respond to a request read from fd
 
         int port;                       //!< server port
-        SOCKET_TYPE listen_socket;      //!< server is listening on this socket
+        SOCKET_TYPE listen_socket;      //!< server is listening on this socket (the first, if several)
         std::string http_host;
         size_t maxRecvBufferSize;       //!< max recv message (post) size (!)
         bool tcp_nodelay;               //!< use TCP_NODELAY (Nagle) ?
         int max_getaddr_tries;          //!< max number of tines to try to get addr
         int getaddr_retry_wait_secs;  //!< wait after bind error before retry
 
+        // timeouts, in ms (0 = none); a request is read by the event loop
+        // and only handed to a process/thread once complete, so a slow
+        // (or silent) client can't pin one
+        unsigned int idle_timeout_ms;   //!< connect to first request byte
+        unsigned int header_timeout_ms; //!< first byte to end of headers
+        unsigned int body_timeout_ms;   //!< end of headers to end of (post) body
+        unsigned int send_timeout_ms;   //!< max block per send while responding (inline: max
+                                        //!< wait for the client to take more of it)
+
+        io_backend_type io_backend;     //!< how the event loop waits/reads, set before start()
+                                        //!< IO_URING_BACKEND needs -DUSE_IO_URING, linux >= 6.0
+
+        // pre-forked mode (not windows): start() forks this many long lived
+        // worker processes, each accepting and responding in its own event
+        // loop (no fork/thread per request); the starting process restarts
+        // any that die.  0 = a process (or thread) per request.
+        int workers;
+        bool reuseport;     //!< workers bind their own SO_REUSEPORT sockets (else share one)
+
+        bool inline_dispatch;   //!< respond in the event loop's thread (no fork/thread);
+                                //!< the loop sends the response as the socket takes it
+        bool lookup_hosts;      //!< getnameinfo() each client (http_host, else ""); off by
+                                //!< default: it blocks the event loop on dns
+
+        size_t cache_max_bytes; //!< response cache budget (see cache()), LRU evicted
+        size_t ws_max_backlog;  //!< a websocket with more unsent than this is dropped
+        size_t ws_max_message;  //!< a websocket sending a bigger message is closed (1009)
+
+        // per request tracing: trace_sink gets a timestamp of each phase
+        // (trace_phase) of 1 in trace_sample requests.  (the USDT probes
+        // simplehttp:phase (fd, phase) and simplehttp:route (fd, route)
+        // fire for all requests, if built with sys/sdt.h)
+        SIMPLEHTTP_TRACE_SINK trace_sink;   //!< NULL = no tracing
+        unsigned int trace_sample;          //!< trace 1 in this many requests
+
         unsigned int log; //!< messages to stdout if > 0
         void *context; //!< ptr passed to callbacks
 
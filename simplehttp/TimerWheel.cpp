@@ -0,0 +1,184 @@
+/*! \file TimerWheel.cpp
+    \brief hierarchical timer wheel, used by SimpleHttp for connection deadlines
+ */
+#include "TimerWheel.hpp"
+#include "SimpleHttp.hpp"
+
+#ifndef MS_WINDOWS
+# include <time.h>
+#else
+# include <windows.h>
+#endif
+
+//!> list helpers; slot heads are sentinels of circular lists
+static inline void tw_list_init( timer_node *head )
+{
+    head->prev = head->next = head;
+}
+
+static inline void tw_list_append( timer_node *head, timer_node *t )
+{
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+static inline void tw_list_unlink( timer_node *t )
+{
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->prev = t->next = NULL;
+}
+
+
+TimerWheel::TimerWheel( unsigned int resolution_ms )
+{
+    for (int level=0; level<TW_LEVELS; level++)
+        for (int i=0; i<TW_SLOTS; i++)
+            tw_list_init( &slot[level][i] );
+    tick_ms = resolution_ms > 0 ? resolution_ms : 1;
+    start_ms = now_ms();
+    current = 0;
+    count = 0;
+}
+
+
+uint64_t TimerWheel::now_ms()
+{
+#ifdef MS_WINDOWS
+    return (uint64_t) GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+uint64_t TimerWheel::now_ns()
+{
+#ifdef MS_WINDOWS
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER count;
+    if ( freq.QuadPart == 0 )
+        QueryPerformanceFrequency( &freq );
+    QueryPerformanceCounter( &count );
+    return (uint64_t)( count.QuadPart / freq.QuadPart ) * 1000000000
+        + (uint64_t)( count.QuadPart % freq.QuadPart ) * 1000000000 / freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+
+//!> hash t into the slot for its expiry, relative to current
+void TimerWheel::add( timer_node *t )
+{
+    int64_t delta = (int64_t)( t->expires - current );
+    if ( delta < 0 ) { // already due: run on the next tick
+        tw_list_append( &slot[0][current & TW_SLOT_MASK], t );
+        return;
+    }
+    int level;
+    for (level=0; level<TW_LEVELS-1; level++)
+        if ( delta < ( (int64_t)1 << (TW_SLOT_BITS*(level+1)) ) )
+            break;
+    if ( delta >= ( (int64_t)1 << (TW_SLOT_BITS*TW_LEVELS) ) ) // beyond the wheel, clamp
+        t->expires = current + ( (uint64_t)1 << (TW_SLOT_BITS*TW_LEVELS) ) - 1;
+    int index = (int)( ( t->expires >> (TW_SLOT_BITS*level) ) & TW_SLOT_MASK );
+    tw_list_append( &slot[level][index], t );
+}
+
+//!> re-hash all timers of one coarse slot (into finer levels)
+void TimerWheel::cascade( int level, int index )
+{
+    timer_node pending;
+    tw_list_init( &pending );
+    timer_node *head = &slot[level][index];
+    if ( head->next == head )
+        return;
+    // move the list to pending, then re-add
+    pending.next = head->next;
+    pending.prev = head->prev;
+    pending.next->prev = &pending;
+    pending.prev->next = &pending;
+    tw_list_init( head );
+    while ( pending.next != &pending ) {
+        timer_node *t = pending.next;
+        tw_list_unlink( t );
+        add( t );
+    }
+}
+
+
+void TimerWheel::schedule( timer_node *t, unsigned int delay_ms )
+{
+    if ( t->pending() )
+        cancel( t );
+    uint64_t ticks = ( delay_ms + tick_ms - 1 ) / tick_ms;
+    t->expires = tick_of( now_ms() ) + ( ticks > 0 ? ticks : 1 );
+    add( t );
+    count++;
+}
+
+void TimerWheel::cancel( timer_node *t )
+{
+    if ( ! t->pending() )
+        return;
+    tw_list_unlink( t );
+    count--;
+}
+
+
+size_t TimerWheel::expire( std::vector<timer_node *> &expired )
+{
+    size_t fired = 0;
+    uint64_t now_tick = tick_of( now_ms() );
+    while ( current <= now_tick ) {
+        int index = (int)( current & TW_SLOT_MASK );
+        if ( index == 0 ) {
+            for (int level=1; level<TW_LEVELS; level++) {
+                int i = (int)( ( current >> (TW_SLOT_BITS*level) ) & TW_SLOT_MASK );
+                cascade( level, i );
+                if ( i != 0 )
+                    break;
+            }
+        }
+        current++;
+        timer_node *head = &slot[0][index];
+        while ( head->next != head ) {
+            timer_node *t = head->next;
+            tw_list_unlink( t );
+            count--;
+            expired.push_back( t );
+            fired++;
+        }
+        if ( count == 0 ) { // nothing left to find, skip ahead
+            current = now_tick + 1;
+            break;
+        }
+    }
+    return fired;
+}
+
+
+long TimerWheel::nextTimeout()
+{
+    if ( count == 0 )
+        return -1;
+    // level 0 holds timers due in the next TW_SLOTS ticks, one tick per slot
+    uint64_t due = current;
+    int i;
+    for (i=0; i<TW_SLOTS; i++, due++) {
+        timer_node *head = &slot[0][due & TW_SLOT_MASK];
+        if ( head->next != head )
+            break;
+    }
+    if ( i == TW_SLOTS ) // nothing close, wake for the next cascade
+        due = ( current + TW_SLOT_MASK ) & ~(uint64_t)TW_SLOT_MASK;
+    uint64_t due_ms = start_ms + due * tick_ms;
+    uint64_t now = now_ms();
+    return due_ms > now ? (long)( due_ms - now ) : 0;
+}
@@ -0,0 +1,62 @@
+/*! \file TimerWheel.hpp
+    \brief hierarchical timer wheel, used by SimpleHttp for connection deadlines
+
+  * schedule and cancel are O(1): timers are intrusive list nodes (the
+    caller owns the storage, e.g. one per connection) hashed into slots
+    by expiry tick; far away timers sit in coarser levels and cascade
+    down as the clock reaches them (as in the classic linux kernel wheel).
+ */
+#ifndef _TIMERWHEEL_HPP
+#define _TIMERWHEEL_HPP 1
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#define TW_LEVELS       4
+#define TW_SLOT_BITS    6
+#define TW_SLOTS        (1 << TW_SLOT_BITS)
+#define TW_SLOT_MASK    (TW_SLOTS - 1)
+
+//!> timer; embed in the object it times, the wheel never allocates
+struct timer_node {
+    timer_node *prev;
+    timer_node *next;   //!< NULL when not scheduled
+    uint64_t expires;   //!< absolute tick
+    int kind;           //!< caller defined
+    void *data;         //!< caller defined
+
+    timer_node() : prev(NULL), next(NULL), expires(0), kind(0), data(NULL) {}
+    bool pending() const { return next != NULL; }
+};
+
+//!> hierarchical timer wheel (TW_LEVELS levels of TW_SLOTS slots)
+class TimerWheel {
+    private:
+        timer_node slot[TW_LEVELS][TW_SLOTS];   //!< list heads
+        uint64_t current;       //!< next tick to run
+        uint64_t start_ms;      //!< clock at tick 0
+        unsigned int tick_ms;   //!< timer resolution
+        size_t count;           //!< scheduled timers
+
+        void add( timer_node *t );
+        void cascade( int level, int index );
+        uint64_t tick_of( uint64_t ms ) const { return (ms - start_ms) / tick_ms; }
+
+        TimerWheel( const TimerWheel & );               // list heads point into this
+        TimerWheel & operator=( const TimerWheel & );   // ... so no copies
+    public:
+        TimerWheel( unsigned int resolution_ms = 10 );
+
+        void schedule( timer_node *t, unsigned int delay_ms ); //!< (re)arm t to fire in delay_ms
+        void cancel( timer_node *t );   //!< disarm t; no-op if not scheduled
+        size_t expire( std::vector<timer_node *> &expired );
+                    //!< advance to now, append timers that fired to expired
+        long nextTimeout();             //!< ms until a timer may fire; -1 if none scheduled
+        size_t size() const { return count; }
+
+        static uint64_t now_ms();       //!< monotonic clock, in ms
+        static uint64_t now_ns();       //!< ... in ns
+};
+
+#endif // _TIMERWHEEL_HPP
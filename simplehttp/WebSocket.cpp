@@ -0,0 +1,205 @@
+/*! \file WebSocket.cpp
+    \brief RFC 6455 websocket framing, for SimpleHttp's websocket routes
+ */
+#include "WebSocket.hpp"
+#include <string.h>
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#elif defined(__ARM_NEON)
+# include <arm_neon.h>
+#endif
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+
+long ws_parse_header( const char *buf, size_t len, ws_header &h )
+{
+    const unsigned char *b = (const unsigned char *) buf;
+    if ( len < 2 )
+        return 0;
+    h.fin = ( b[0] & 0x80 ) != 0;
+    h.opcode = b[0] & 0x0f;
+    h.masked = ( b[1] & 0x80 ) != 0;
+    if ( b[0] & 0x70 )
+        return -1; // (no extensions negotiated, so no rsv bits)
+
+    size_t n = 2;
+    uint64_t size = b[1] & 0x7f;
+    if ( size == 126 ) {
+        if ( len < n + 2 )
+            return 0;
+        size = ( (uint64_t)b[2] << 8 ) | b[3];
+        n += 2;
+    }
+    else if ( size == 127 ) {
+        if ( len < n + 8 )
+            return 0;
+        size = 0;
+        for (int i=0; i<8; i++)
+            size = ( size << 8 ) | b[2+i];
+        n += 8;
+        if ( size >> 62 )
+            return -1;
+    }
+    if ( h.opcode & 0x8 ) { // control frames: short and unfragmented
+        if ( size > 125 || ! h.fin )
+            return -1;
+    }
+    if ( h.masked ) {
+        if ( len < n + 4 )
+            return 0;
+        memcpy( h.mask, b + n, 4 );
+        n += 4;
+    }
+    h.header_size = n;
+    h.payload_size = size;
+    return (long) n; // (caller checks the payload's all in)
+}
+
+
+std::string ws_frame_header( int opcode, uint64_t payload_size, bool fin )
+{
+    unsigned char h[10];
+    size_t n = 2;
+    h[0] = (unsigned char)( ( fin ? 0x80 : 0 ) | ( opcode & 0x0f ) );
+    if ( payload_size < 126 )
+        h[1] = (unsigned char) payload_size;
+    else if ( payload_size <= 0xffff ) {
+        h[1] = 126;
+        h[2] = (unsigned char)( payload_size >> 8 );
+        h[3] = (unsigned char) payload_size;
+        n = 4;
+    }
+    else {
+        h[1] = 127;
+        for (int i=0; i<8; i++)
+            h[2+i] = (unsigned char)( payload_size >> ( 8 * (7-i) ) );
+        n = 10;
+    }
+    return std::string( (const char *)h, n );
+}
+
+std::string ws_frame( int opcode, const std::string &payload )
+{
+    return ws_frame_header( opcode, payload.size() ) + payload;
+}
+
+
+void ws_unmask( char *data, size_t len, const unsigned char mask[4] )
+{
+    // (the key repeats every 4 bytes, so whole blocks xor with it as is)
+    size_t i = 0;
+    uint32_t m32;
+    memcpy( &m32, mask, 4 );
+#if defined(__SSE2__)
+    __m128i m128 = _mm_set1_epi32( (int) m32 );
+    for ( ; i + 16 <= len; i += 16 ) {
+        __m128i d = _mm_loadu_si128( (const __m128i *)( data + i ) );
+        _mm_storeu_si128( (__m128i *)( data + i ), _mm_xor_si128( d, m128 ) );
+    }
+#elif defined(__ARM_NEON)
+    uint8x16_t m128 = vreinterpretq_u8_u32( vdupq_n_u32( m32 ) );
+    for ( ; i + 16 <= len; i += 16 ) {
+        uint8x16_t d = vld1q_u8( (const uint8_t *)( data + i ) );
+        vst1q_u8( (uint8_t *)( data + i ), veorq_u8( d, m128 ) );
+    }
+#endif
+    uint64_t m64 = ( (uint64_t)m32 << 32 ) | m32;
+    for ( ; i + 8 <= len; i += 8 ) {
+        uint64_t d;
+        memcpy( &d, data + i, 8 );
+        d ^= m64;
+        memcpy( data + i, &d, 8 );
+    }
+    for ( ; i < len; i++ )
+        data[i] ^= mask[ i & 3 ];
+}
+
+
+#define ROL32(x,n)  ( ( (x) << (n) ) | ( (x) >> ( 32 - (n) ) ) )
+
+//!> one 64 byte block
+static void sha1_block( uint32_t h[5], const unsigned char *p )
+{
+    uint32_t w[80];
+    for (int i=0; i<16; i++)
+        w[i] = ( (uint32_t)p[4*i] << 24 ) | ( (uint32_t)p[4*i+1] << 16 )
+             | ( (uint32_t)p[4*i+2] << 8 ) | p[4*i+3];
+    for (int i=16; i<80; i++)
+        w[i] = ROL32( w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1 );
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i=0; i<80; i++) {
+        uint32_t f, k;
+        if ( i < 20 )      { f = ( b & c ) | ( ~b & d );            k = 0x5A827999; }
+        else if ( i < 40 ) { f = b ^ c ^ d;                         k = 0x6ED9EBA1; }
+        else if ( i < 60 ) { f = ( b & c ) | ( b & d ) | ( c & d ); k = 0x8F1BBCDC; }
+        else               { f = b ^ c ^ d;                         k = 0xCA62C1D6; }
+        uint32_t t = ROL32( a, 5 ) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = ROL32( b, 30 );
+        b = a;
+        a = t;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+}
+
+//!> sha-1, for the handshake's accept key
+static void sha1( const void *data, size_t len, unsigned char digest[20] )
+{
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    const unsigned char *p = (const unsigned char *) data;
+    size_t left = len;
+    for ( ; left >= 64; left -= 64, p += 64 )
+        sha1_block( h, p );
+
+    // the tail, 0x80, zeros, then the length in bits (big endian)
+    unsigned char last[128];
+    memset( last, 0, sizeof(last) );
+    memcpy( last, p, left );
+    last[left] = 0x80;
+    size_t n = ( left + 9 <= 64 ) ? 64 : 128;
+    uint64_t bits = (uint64_t) len * 8;
+    for (int i=0; i<8; i++)
+        last[n-1-i] = (unsigned char)( bits >> ( 8 * i ) );
+    sha1_block( h, last );
+    if ( n == 128 )
+        sha1_block( h, last + 64 );
+
+    for (int i=0; i<5; i++) {
+        digest[4*i]   = (unsigned char)( h[i] >> 24 );
+        digest[4*i+1] = (unsigned char)( h[i] >> 16 );
+        digest[4*i+2] = (unsigned char)( h[i] >> 8 );
+        digest[4*i+3] = (unsigned char) h[i];
+    }
+}
+
+
+static std::string base64_encode( const unsigned char *data, size_t len )
+{
+    static const char digits[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string s;
+    s.reserve( ( len + 2 ) / 3 * 4 );
+    for (size_t i=0; i<len; i+=3) {
+        uint32_t v = (uint32_t)data[i] << 16;
+        if ( i+1 < len ) v |= (uint32_t)data[i+1] << 8;
+        if ( i+2 < len ) v |= data[i+2];
+        s += digits[ ( v >> 18 ) & 63 ];
+        s += digits[ ( v >> 12 ) & 63 ];
+        s += ( i+1 < len ) ? digits[ ( v >> 6 ) & 63 ] : '=';
+        s += ( i+2 < len ) ? digits[ v & 63 ] : '=';
+    }
+    return s;
+}
+
+
+std::string ws_accept_key( const std::string &key )
+{
+    std::string s = key + WS_GUID;
+    unsigned char digest[20];
+    sha1( s.data(), s.size(), digest );
+    return base64_encode( digest, sizeof(digest) );
+}
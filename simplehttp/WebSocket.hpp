@@ -0,0 +1,46 @@
+/*! \file WebSocket.hpp
+    \brief RFC 6455 websocket framing, for SimpleHttp's websocket routes
+
+  * the handshake's Sec-WebSocket-Accept (sha-1, base64), frame header
+    parsing and building, and payload unmasking (sse2/neon, or 8 bytes
+    at a time); the connections themselves live in SimpleHttp
+ */
+#ifndef _WEBSOCKET_HPP
+#define _WEBSOCKET_HPP 1
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+enum ws_opcode {
+    WS_OP_CONTINUATION = 0x0,
+    WS_OP_TEXT = 0x1,
+    WS_OP_BINARY = 0x2,
+    WS_OP_CLOSE = 0x8,
+    WS_OP_PING = 0x9,
+    WS_OP_PONG = 0xA
+};
+
+//!> a frame's header, as parsed by ws_parse_header()
+struct ws_header {
+    bool fin;
+    int opcode;
+    bool masked;
+    unsigned char mask[4];
+    size_t header_size;
+    uint64_t payload_size;
+};
+
+long ws_parse_header( const char *buf, size_t len, ws_header &h );
+            //!< parse the frame header at buf: its header + payload size, 0 if incomplete, -1 if bad
+std::string ws_frame_header( int opcode, uint64_t payload_size, bool fin=true );
+            //!< header of a server (unmasked) frame
+std::string ws_frame( int opcode, const std::string &payload );
+            //!< a whole (single frame) message
+void ws_unmask( char *data, size_t len, const unsigned char mask[4] );
+            //!< xor a frame's payload with its masking key (in place)
+
+std::string ws_accept_key( const std::string &key );
+            //!< Sec-WebSocket-Accept for a Sec-WebSocket-Key
+
+#endif // _WEBSOCKET_HPP
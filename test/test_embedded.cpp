@@ -0,0 +1,64 @@
+#include <SimpleHttp.hpp>
+#include <stdlib.h>
+#include <stdio.h>
+#include <poll.h>
+#include <time.h>
+#include <iostream>
+#include <vector>
+// demo libsimplehttp, driven from the application's own poll() loop
+// (no forks, no threads: pages are served from the loop's thread)
+
+static int ticks = 0; // the application's own work, done in the same loop
+
+void status_page( SimpleHttp *s, SOCKET_TYPE fd, std::string route,
+        std::map <std::string, std::string> *param, std::string request, void *context)
+{
+    char buf[128];
+    snprintf( buf, sizeof(buf), "<html><body>ticks so far: %d</body></html>", ticks );
+    s->http_send_ok(fd);
+    s->http_send(fd, buf);
+}
+
+int main( int argc, char *argv[] ) {   
+    SimpleHttp server( argc >= 2 ? atoi(argv[1]) : 9192 );  // define server obj, port
+    server.log = 1;
+    server.inline_dispatch = true;  // respond in this thread
+    server.page( "/", status_page );
+    if ( ! server.start() )
+        return 1;
+    std::cout << "listening ... http://localhost:"<<server.port<<std::endl;
+
+    std::vector< watch_fd > watch;
+    std::vector< struct pollfd > fds;
+    time_t last_tick = time(NULL);
+    for (;;) {
+        // the server's sockets (plus, in a real program, the application's own)
+        server.getFds( watch );
+        fds.resize( watch.size() );
+        for (size_t i=0; i<watch.size(); i++) {
+            fds[i].fd = watch[i].fd;
+            fds[i].events = (watch[i].events & EVENT_READ ? POLLIN : 0)
+                          | (watch[i].events & EVENT_WRITE ? POLLOUT : 0);
+            fds[i].revents = 0;
+        }
+        long timeout = server.nextTimeout();
+        if ( timeout < 0 || timeout > 1000 )
+            timeout = 1000; // (the application ticks once a second)
+
+        int n = poll( fds.empty() ? NULL : &fds[0], fds.size(), (int)timeout );
+        for (size_t i=0; n>0 && i<fds.size(); i++) {
+            if ( fds[i].revents == 0 )
+                continue;
+            n--;
+            server.processReady( fds[i].fd,
+                    (fds[i].revents & (POLLIN|POLLHUP|POLLERR) ? EVENT_READ : 0)
+                  | (fds[i].revents & POLLOUT ? EVENT_WRITE : 0) );
+        }
+        server.processTimers();
+
+        if ( time(NULL) != last_tick ) {
+            last_tick = time(NULL);
+            ticks++;
+        }
+    }
+}
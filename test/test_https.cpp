@@ -0,0 +1,39 @@
+#include <SimpleHttp.hpp>
+#include <stdlib.h>
+#include <iostream>
+// demo libsimplehttp https (build with -DUSE_OPENSSL=ON); a self-signed
+// certificate for trying it on loopback (the openssl command is one line):
+//
+//   openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:P-256 -nodes
+//       -keyout key.pem -out cert.pem -days 30 -subj /CN=localhost
+//       -addext "subjectAltName=DNS:localhost,IP:127.0.0.1,IP:::1"
+//   ./test_https cert.pem key.pem
+//   curl --cacert cert.pem https://localhost:9443/
+
+void hello( SimpleHttp *s, SOCKET_TYPE fd, std::string route,
+        std::map <std::string, std::string> *param, std::string req, void *context )
+{
+    s->http_send_ok( fd, "Content-Type: text/plain\n" );
+    s->http_send( fd, "hello, over tls\n" );
+}
+
+int main( int argc, char *argv[] ) {
+    if ( argc < 3 ) {
+        std::cout << "usage: test_https cert.pem key.pem [https port] [http port]" << std::endl;
+        return 1;
+    }
+    SimpleHttp server;
+    server.log = 1;
+    if ( ! server.tls( argv[1], argv[2] ) )
+        return 1;
+    int port = argc >= 4 ? atoi(argv[3]) : 9443;
+    server.addListener( "", port, true );
+    server.addListener( "", argc >= 5 ? atoi(argv[4]) : 9080 ); // and plain http
+    server.page( "/", hello );
+    server.file( "/source", __FILE__ );     // (sent by sendfile, where the kernel does tls)
+    if ( ! server.start() )
+        return 1;
+    std::cout << "listening ... https://localhost:"<<port<<std::endl;
+    server.eventLoop();
+    return 0;
+}
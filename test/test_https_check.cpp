@@ -0,0 +1,133 @@
+#include <SimpleHttp.hpp>
+#include <openssl/ssl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <iostream>
+#include <string>
+#include <thread>
+// check libsimplehttp https end to end (build with -DUSE_OPENSSL=ON): a tls
+// client gets each route (callbacks, and a 1MB file(), over 16k tls records)
+// from a server responding by fork/thread, then from one responding inline;
+// exits 1 on a failure.  A certificate as for test/test_https.cpp:
+//
+//   ./test_https_check cert.pem key.pem
+
+static int failures = 0;
+
+static void check( bool ok, const std::string &what )
+{
+    std::cout << ( ok ? "ok    " : "FAIL  " ) << what << std::endl;
+    if ( ! ok )
+        failures++;
+}
+
+void hello( SimpleHttp *s, SOCKET_TYPE fd, std::string route,
+        std::map <std::string, std::string> *param, std::string req, void *context )
+{
+    s->http_send_ok( fd, "Content-Type: text/plain\n" );
+    s->http_send( fd, "hello, over tls\n" );
+}
+
+// a callback writing the response itself, by SOCKET_SEND (encrypted too)
+void raw( SimpleHttp *s, SOCKET_TYPE fd, std::string route,
+        std::map <std::string, std::string> *param, std::string req, void *context )
+{
+    static const char response[] = "HTTP/1.0 200 OK\nContent-Type: text/plain\n\nsent raw\n";
+    SOCKET_SEND( fd, response, sizeof(response) - 1 );
+}
+
+//! GET path over tls: the body of a 200 response, or "" (ok false)
+static std::string get( SSL_CTX *ctx, int port, const std::string &path, bool &ok )
+{
+    ok = false;
+    int fd = socket( AF_INET, SOCK_STREAM, 0 );
+    struct sockaddr_in addr;
+    memset( &addr, 0, sizeof(addr) );
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons( port );
+    addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    struct timeval tv = { 10, 0 }; // (a hang is a failure)
+    setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv) );
+    std::string response;
+    SSL *ssl = SSL_new( ctx );
+    SSL_set_fd( ssl, fd );
+    if ( connect( fd, (struct sockaddr *)&addr, sizeof(addr) ) == 0
+            && SSL_connect( ssl ) == 1 ) {
+        std::string req = "GET " + path + " HTTP/1.0\r\nHost: localhost\r\n\r\n";
+        SSL_write( ssl, req.data(), (int) req.size() );
+        char buf[16384];
+        int n;
+        while ( ( n = SSL_read( ssl, buf, sizeof(buf) ) ) > 0 )
+            response.append( buf, n );
+    }
+    SSL_free( ssl );
+    close( fd );
+
+    size_t end = response.find( "\n\n" );
+    if ( end == std::string::npos || response.compare( 0, 12, "HTTP/1.0 200" ) != 0 )
+        return "";
+    ok = true;
+    return response.substr( end + 2 );
+}
+
+static std::string big; // the file() route's contents
+
+static void client( int port, const std::string &mode )
+{
+    SSL_CTX *ctx = SSL_CTX_new( TLS_client_method() );
+    SSL_CTX_set_verify( ctx, SSL_VERIFY_NONE, NULL ); // (the server's checked, not its certificate)
+    bool ok;
+    std::string body = get( ctx, port, "/", ok );
+    check( ok && body == "hello, over tls\n", mode + ": http_send() callback" );
+    body = get( ctx, port, "/raw", ok );
+    check( ok && body == "sent raw\n", mode + ": SOCKET_SEND() callback" );
+    body = get( ctx, port, "/big", ok );
+    check( ok && body == big, mode + ": file() intact" );
+    SSL_CTX_free( ctx );
+}
+
+int main( int argc, char *argv[] ) {
+    if ( argc < 3 ) {
+        std::cout << "usage: test_https_check cert.pem key.pem [https port]" << std::endl;
+        return 1;
+    }
+    SimpleHttp server;
+    if ( ! server.tls( argv[1], argv[2] ) )
+        return 1;
+    int port = argc >= 4 ? atoi(argv[3]) : 9444;
+    server.addListener( "", port, true );
+    server.page( "/", hello );
+    server.page( "/raw", raw );
+
+    char path[] = "/tmp/test_https_check.XXXXXX";
+    int fd = mkstemp( path );
+    big.resize( 1024 * 1024 + 7 );
+    for (size_t i=0; i<big.size(); i++)
+        big[i] = (char)( ( i * 2654435761u ) >> 13 );
+    if ( fd < 0 || write( fd, big.data(), big.size() ) != (ssize_t) big.size() ) {
+        perror( "test_https_check" );
+        return 1;
+    }
+    close( fd );
+    server.file( "/big", path );
+    for (int inline_dispatch=0; inline_dispatch<2; inline_dispatch++) {
+        server.inline_dispatch = ( inline_dispatch != 0 );
+        if ( ! server.start() )
+            return 1;
+        std::thread t( [&server, port, inline_dispatch]() {
+            client( port, inline_dispatch ? "inline" : "responder" );
+            server.stop();
+        } );
+        server.eventLoop();
+        t.join();
+        server.closeServer();
+    }
+    unlink( path );
+    std::cout << ( failures ? "FAILED" : "passed" ) << std::endl;
+    return failures ? 1 : 0;
+}
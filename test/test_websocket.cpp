@@ -0,0 +1,54 @@
+#include <SimpleHttp.hpp>
+#include <stdlib.h>
+#include <unistd.h>
+#include <iostream>
+#include <thread>
+// demo libsimplehttp websockets: a browser UI the application pushes to
+// (no polling), and that talks back
+
+void chat( SimpleHttp *s, websocket_id ws, ws_event event, std::string route,
+        const std::string &data, bool binary, void *context )
+{
+    if ( event == WS_MESSAGE ) // (runs on the event loop's thread)
+        s->ws_broadcast( "/chat", data );
+}
+
+void clock_ws( SimpleHttp *s, websocket_id ws, ws_event event, std::string route,
+        const std::string &data, bool binary, void *context )
+{
+    // nothing to do: the clock thread broadcasts to all of them
+}
+
+int main( int argc, char *argv[] ) {
+    SimpleHttp server( argc >= 2 ? atoi(argv[1]) : 9193 );  // define server obj, port
+    server.log = 1;
+    server.page( "/",
+            "<html><body>"
+            "<p id='clock'></p>"
+            "<input id='say' placeholder='say something'><pre id='chat'></pre>"
+            "<script>"
+            "var c = new WebSocket('ws://' + location.host + '/clock');"
+            "c.onmessage = function(e) { clock.textContent = e.data; };"
+            "var t = new WebSocket('ws://' + location.host + '/chat');"
+            "t.onmessage = function(e) { chat.textContent += e.data + '\\n'; };"
+            "say.onchange = function() { t.send(say.value); say.value = ''; };"
+            "</script>"
+            "</body></html>" );
+    server.websocket( "/clock", clock_ws );
+    server.websocket( "/chat", chat );
+    if ( ! server.start() )
+        return 1;
+    std::cout << "listening ... http://localhost:"<<server.port<<std::endl;
+
+    // the application's own thread, pushing to every /clock websocket
+    std::thread clock( [&server]() {
+        for (;;) {
+            sleep(1);
+            time_t now = time(NULL);
+            server.ws_broadcast( "/clock", ctime( &now ) );
+        }
+    } );
+    clock.detach();
+
+    server.eventLoop();
+}
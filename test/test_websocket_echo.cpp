@@ -0,0 +1,158 @@
+#include <SimpleHttp.hpp>
+#include <WebSocket.hpp>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <iostream>
+#include <string>
+#include <thread>
+// check libsimplehttp websockets end to end: a raw socket client against an
+// echo route (masked frames, a 300KB message, a fragmented one with a ping
+// between its fragments, one over ws_max_message); exits 1 on a failure
+
+static int failures = 0;
+
+static void check( bool ok, const char *what )
+{
+    std::cout << ( ok ? "ok    " : "FAIL  " ) << what << std::endl;
+    if ( ! ok )
+        failures++;
+}
+
+void echo( SimpleHttp *s, websocket_id ws, ws_event event, std::string route,
+        const std::string &data, bool binary, void *context )
+{
+    if ( event == WS_MESSAGE )
+        s->ws_send( ws, data, binary );
+}
+
+// the client's side: frames it sends are masked, the server's aren't
+
+static bool send_all( int fd, const std::string &buf )
+{
+    size_t sent = 0;
+    while ( sent < buf.size() ) {
+        ssize_t n = send( fd, buf.data() + sent, buf.size() - sent, MSG_NOSIGNAL );
+        if ( n <= 0 )
+            return false;
+        sent += n;
+    }
+    return true;
+}
+
+static std::string client_frame( int opcode, const std::string &payload, bool fin=true )
+{
+    static const unsigned char mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+    std::string frame = ws_frame_header( opcode, payload.size(), fin );
+    frame[1] |= (char)0x80;
+    frame.append( (const char *)mask, 4 );
+    std::string data( payload );
+    ws_unmask( &data[0], data.size(), mask ); // (xor: masks too)
+    return frame + data;
+}
+
+static std::string in; // received, not yet taken
+
+//! next frame from the server (opcode -1 on eof, or a bad frame)
+static int recv_frame( int fd, std::string &payload )
+{
+    for (;;) {
+        ws_header h;
+        long n = ws_parse_header( in.data(), in.size(), h );
+        if ( n < 0 || ( n > 0 && h.masked ) )
+            return -1;
+        if ( n > 0 && in.size() >= n + h.payload_size ) {
+            payload = in.substr( n, (size_t) h.payload_size );
+            in.erase( 0, n + (size_t) h.payload_size );
+            return h.opcode;
+        }
+        char buf[65536];
+        ssize_t got = recv( fd, buf, sizeof(buf), 0 );
+        if ( got <= 0 )
+            return -1;
+        in.append( buf, got );
+    }
+}
+
+static void client( int port )
+{
+    int fd = socket( AF_INET, SOCK_STREAM, 0 );
+    struct sockaddr_in addr;
+    memset( &addr, 0, sizeof(addr) );
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons( port );
+    addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    if ( connect( fd, (struct sockaddr *)&addr, sizeof(addr) ) != 0 ) {
+        check( false, "connect" );
+        close( fd );
+        return;
+    }
+    struct timeval tv = { 10, 0 }; // (a hang is a failure)
+    setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv) );
+
+    // the handshake (the key and accept are RFC 6455's example)
+    send_all( fd, "GET /echo HTTP/1.1\r\nHost: localhost\r\n"
+            "Upgrade: websocket\r\nConnection: Upgrade\r\n"
+            "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+            "Sec-WebSocket-Version: 13\r\n\r\n" );
+    size_t end;
+    while ( ( end = in.find( "\r\n\r\n" ) ) == std::string::npos ) {
+        char buf[4096];
+        ssize_t got = recv( fd, buf, sizeof(buf), 0 );
+        if ( got <= 0 )
+            break;
+        in.append( buf, got );
+    }
+    std::string response = in.substr( 0, end == std::string::npos ? in.size() : end );
+    in.erase( 0, end == std::string::npos ? in.size() : end + 4 );
+    check( response.compare( 0, 12, "HTTP/1.1 101" ) == 0
+            && response.find( "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=" ) != std::string::npos,
+            "handshake: 101, Sec-WebSocket-Accept" );
+
+    std::string payload;
+    send_all( fd, client_frame( WS_OP_TEXT, "hello" ) );
+    int op = recv_frame( fd, payload );
+    check( op == WS_OP_TEXT && payload == "hello", "text message echoed" );
+
+    std::string big( 300 * 1024, '\0' );
+    for (size_t i=0; i<big.size(); i++)
+        big[i] = (char)( ( i * 2654435761u ) >> 13 );
+    send_all( fd, client_frame( WS_OP_BINARY, big ) );
+    op = recv_frame( fd, payload );
+    check( op == WS_OP_BINARY && payload == big, "300KB binary message echoed" );
+
+    send_all( fd, client_frame( WS_OP_TEXT, "frag", false )
+            + client_frame( WS_OP_CONTINUATION, "men", false )
+            + client_frame( WS_OP_PING, "are you there" )
+            + client_frame( WS_OP_CONTINUATION, "ted" ) );
+    op = recv_frame( fd, payload );
+    check( op == WS_OP_PONG && payload == "are you there", "ping between fragments: pong" );
+    op = recv_frame( fd, payload );
+    check( op == WS_OP_TEXT && payload == "fragmented", "fragmented message echoed whole" );
+
+    // over ws_max_message: closed on its header, before the payload comes
+    std::string over = ws_frame_header( WS_OP_BINARY, 1024 * 1024 + 1 );
+    over[1] |= (char)0x80;
+    send_all( fd, over + std::string( 4 + 1024, 'x' ) ); // (mask key, the payload's start)
+    op = recv_frame( fd, payload );
+    check( op == WS_OP_CLOSE && payload.size() >= 2
+            && ( ( (unsigned char)payload[0] << 8 ) | (unsigned char)payload[1] ) == 1009,
+            "message over ws_max_message: close 1009" );
+    close( fd );
+}
+
+int main( int argc, char *argv[] ) {
+    SimpleHttp server( argc >= 2 ? atoi(argv[1]) : 9194 );  // define server obj, port
+    server.websocket( "/echo", echo );
+    if ( ! server.start() )
+        return 1;
+    std::thread t( [&server]() { client( server.port ); server.stop(); } );
+    server.eventLoop();
+    t.join();
+    server.closeServer();
+    std::cout << ( failures ? "FAILED" : "passed" ) << std::endl;
+    return failures ? 1 : 0;
+}